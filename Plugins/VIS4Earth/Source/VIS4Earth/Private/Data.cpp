@@ -5,106 +5,667 @@
 #include <array>
 #include <map>
 
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Compression.h"
+#include "Misc/ScopeLock.h"
+
+#include "VolumeSmootherCPU.h"
+#include "VolumeTransposer.h"
+
+bool VolumeCPUData::MapFile(const FString &FilePath) {
+    Empty();
+
+    TSharedPtr<IMappedFileHandle> file(
+        FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*FilePath));
+    if (!file.IsValid() || file->GetFileSize() <= 0)
+        return false;
+
+    TSharedPtr<IMappedFileRegion> region(file->MapRegion(0, file->GetFileSize()));
+    if (!region.IsValid())
+        return false;
+
+    mappedFile = MoveTemp(file);
+    mappedRegion = MoveTemp(region);
+    return true;
+}
+
+bool VolumeCPUData::LoadFile(const FString &FilePath) {
+    Empty();
+    return FFileHelper::LoadFileToArray(owned, *FilePath);
+}
+
+bool VolumeData::OpenedFile::Read(int64 Offset, uint8 *Dst, int64 Size) const {
+    FScopeLock lock(&HandleMutex);
+    return Handle->Seek(Offset) && Handle->Read(Dst, Size);
+}
+
+TVariant<TSharedRef<const VolumeData::OpenedFile>, FString>
+VolumeData::OpenFile(const FFilePath &FilePath) {
+    using RetType = TVariant<TSharedRef<const OpenedFile>, FString>;
+
+    auto file = MakeShared<OpenedFile>();
+    if (IsContainerFile(FilePath.FilePath)) {
+        auto ret = LoadContainerHeaderFromFile(FilePath);
+        if (ret.IsType<FString>())
+            return RetType(TInPlaceType<FString>(), ret.Get<FString>());
+        file->ContainerHeader = MoveTemp(ret.Get<VolumeContainerHeader>());
+    }
+
+    // Fall back to positional reads on platforms without memory-mapping
+    if (file->Mapped.MapFile(FilePath.FilePath))
+        file->FileSize = file->Mapped.Num();
+    else {
+        file->Handle.Reset(
+            FPlatformFileManager::Get().GetPlatformFile().OpenRead(*FilePath.FilePath));
+        if (!file->Handle.IsValid())
+            return RetType(TInPlaceType<FString>(),
+                           FString::Format(TEXT("Invalid FilePath {0}."), {FilePath.FilePath}));
+        file->FileSize = file->Handle->Size();
+    }
+
+    return RetType(TInPlaceType<TSharedRef<const OpenedFile>>(), file);
+}
+
 TVariant<UVolumeTexture *, FString>
 VolumeData::LoadFromFile(const LoadFromFileDesc &Desc,
-                         TOptional<std::reference_wrapper<TArray<uint8>>> VolumeOut) {
+                         TOptional<std::reference_wrapper<VolumeCPUData>> VolumeOut) {
     using RetType = TVariant<UVolumeTexture *, FString>;
 
+    if (VolumeOut.IsSet()) {
+        auto ret = LoadCPUDataFromFile(Desc, VolumeOut->get());
+        if (ret.IsType<FString>())
+            return RetType(TInPlaceType<FString>(), ret.Get<FString>());
+
+        return RetType(TInPlaceType<UVolumeTexture *>(),
+                       CreateTextureFromCPUData(VolumeOut->get(), Desc.VoxTy,
+                                                ret.Get<FIntVector3>(), Desc.Name));
+    }
+
+    // Without a copy in CPU, voxels are loaded straight into the bulk data of the texture
+    UVolumeTexture *tex = nullptr;
+    auto ret = loadCPUDataFromFile(
+        Desc,
+        [&](const FIntVector3 &Dimension) {
+            tex = createTransientTexture(Desc.VoxTy, Dimension, Desc.Name);
+            return static_cast<uint8 *>(
+                tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE));
+        },
+        nullptr, nullptr, nullptr);
+    if (tex)
+        tex->GetPlatformData()->Mips[0].BulkData.Unlock();
+    if (ret.IsType<FString>())
+        return RetType(TInPlaceType<FString>(), ret.Get<FString>());
+
+    tex->UpdateResource();
+    return RetType(TInPlaceType<UVolumeTexture *>(), tex);
+}
+
+TVariant<FIntVector3, FString> VolumeData::LoadCPUDataFromFile(const LoadFromFileDesc &Desc,
+                                                               VolumeCPUData &VolumeOut,
+                                                               LoadFromFileState *State) {
+    auto voxSz = static_cast<int64>(GetVoxelSize(Desc.VoxTy));
+    auto ret = loadCPUDataFromFile(
+        Desc, nullptr,
+        [&](const FIntVector3 &Dimension) {
+            return VolumeOut.Own(voxSz * Dimension.X * Dimension.Y * Dimension.Z).GetData();
+        },
+        &VolumeOut, State);
+    if (ret.IsType<FString>())
+        VolumeOut.Empty();
+
+    return ret;
+}
+
+TVariant<FIntVector3, FString> VolumeData::LoadCPUDataFromFile(const LoadFromFileDesc &Desc,
+                                                               const OpenedFile &File,
+                                                               VolumeCPUData &VolumeOut,
+                                                               LoadFromFileState *State) {
+    auto voxSz = static_cast<int64>(GetVoxelSize(Desc.VoxTy));
+    auto ret = loadCPUDataFromFile(
+        Desc, &File,
+        [&](const FIntVector3 &Dimension) {
+            return VolumeOut.Own(voxSz * Dimension.X * Dimension.Y * Dimension.Z).GetData();
+        },
+        nullptr, State);
+    if (ret.IsType<FString>())
+        VolumeOut.Empty();
+
+    return ret;
+}
+
+TVariant<FIntVector3, FString>
+VolumeData::loadCPUDataFromFile(const LoadFromFileDesc &Desc, const OpenedFile *File,
+                                TFunctionRef<uint8 *(const FIntVector3 &)> AllocOut,
+                                VolumeCPUData *AliasOut, LoadFromFileState *State) {
+    using RetType = TVariant<FIntVector3, FString>;
+
     if (Desc.Dimension.X <= 0 || Desc.Dimension.Y <= 0 || Desc.Dimension.Z <= 0)
         return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Dimension {0}."),
                                                                 {Desc.Dimension.ToString()}));
+    if (GetVoxelSize(Desc.VoxTy) == 0)
+        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    if ([&]() {
+            FIntVector3 cnts(0, 0, 0);
+            for (int i = 0; i < 3; ++i)
+                if (auto j = std::abs(Desc.Axis[i]) - 1; 0 <= j && j <= 2)
+                    ++cnts[j];
+                else
+                    return true;
+            for (int i = 0; i < 3; ++i)
+                if (cnts[i] != 1)
+                    return true;
+            return false;
+        }())
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Invalid Desc.Axis {0},{1},{2}."),
+                                       {Desc.Axis[0], Desc.Axis[1], Desc.Axis[2]}));
+
+    auto trDim = FVolumeTransposer::GetTransposedDimension(Desc.Axis, Desc.Dimension);
+    auto roiMax = Desc.ROIMax == FIntVector3::ZeroValue ? trDim : Desc.ROIMax;
+    if ([&]() {
+            for (int i = 0; i < 3; ++i)
+                if (Desc.ROIMin[i] < 0 || Desc.ROIMin[i] >= roiMax[i] || roiMax[i] > trDim[i] ||
+                    Desc.ROIStride[i] <= 0)
+                    return true;
+            return false;
+        }())
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Invalid Desc.ROI {0}-{1} every {2}."),
+                                       {Desc.ROIMin.ToString(), roiMax.ToString(),
+                                        Desc.ROIStride.ToString()}));
+
+    // Whole RAW volumes are mapped below to be aliased instead
+    TSharedPtr<const OpenedFile> opened;
+    auto isWholeVolume = Desc.ROIMin == FIntVector3::ZeroValue && roiMax == trDim &&
+                         Desc.ROIStride == FIntVector3(1, 1, 1);
+    if (!File && (!isWholeVolume || IsContainerFile(Desc.FilePath.FilePath))) {
+        auto ret = OpenFile(Desc.FilePath);
+        if (ret.IsType<FString>())
+            return RetType(TInPlaceType<FString>(), ret.Get<FString>());
+        opened = ret.Get<TSharedRef<const OpenedFile>>();
+        File = opened.Get();
+    }
+    if (File && File->ContainerHeader.IsSet())
+        return loadCPUDataFromContainer(Desc, roiMax, *File, AllocOut, State);
+
+    auto isCancelled = [&]() { return State && State->Cancelled; };
+    auto cancelledRet = [&]() { return RetType(TInPlaceType<FString>(), TEXT("Cancelled.")); };
+    auto addProgress = [&](float dlt) {
+        if (State)
+            State->Progress += dlt;
+    };
 
-    TArray<uint8> buf;
-    if (!FFileHelper::LoadFileToArray(buf, *Desc.FilePath.FilePath))
+    auto voxSz = static_cast<int64>(GetVoxelSize(Desc.VoxTy));
+    auto volSz = voxSz * Desc.Dimension.X * Desc.Dimension.Y * Desc.Dimension.Z;
+    auto isIdentityAxis = Desc.Axis == decltype(Desc.Axis)(1, 2, 3);
+
+    if (File) {
+        // Select the ROI in the un-transposed source, which keeps the same axis order as the file
+        FIntVector3 roiDim, srcStart, srcStride, srcNum;
+        for (int i = 0; i < 3; ++i) {
+            auto j = std::abs(Desc.Axis[i]) - 1;
+            roiDim[i] = FMath::DivideAndRoundUp(roiMax[i] - Desc.ROIMin[i], Desc.ROIStride[i]);
+            srcNum[j] = roiDim[i];
+            srcStride[j] = Desc.ROIStride[i];
+            srcStart[j] = Desc.Axis[i] > 0 ? Desc.ROIMin[i]
+                                           : trDim[i] - 1 - Desc.ROIMin[i] -
+                                                 (roiDim[i] - 1) * Desc.ROIStride[i];
+        }
+
+        // Only read rows intersecting the ROI, either from the mapping or by positional reads
+        if (File->FileSize != volSz)
+            return RetType(TInPlaceType<FString>(),
+                           FString::Format(TEXT("Invalid contents in Desc.FilePath {0}."),
+                                           {Desc.FilePath.FilePath}));
+
+        auto rowSz = voxSz * srcNum.X;
+        auto srcRowSpanSz = voxSz * ((srcNum.X - 1) * srcStride.X + 1);
+        auto copyRow = [&](uint8 *dst, const uint8 *src) {
+            if (srcStride.X == 1)
+                FMemory::Memcpy(dst, src, rowSz);
+            else
+                for (int32 x = 0; x < srcNum.X; ++x)
+                    FMemory::Memcpy(dst + x * voxSz, src + x * srcStride.X * voxSz, voxSz);
+        };
+        auto srcRowOffs = [&](int32 y, int32 z) {
+            return voxSz * ((static_cast<int64>(srcStart.Z) + z * srcStride.Z) * Desc.Dimension.Y *
+                                Desc.Dimension.X +
+                            (static_cast<int64>(srcStart.Y) + y * srcStride.Y) * Desc.Dimension.X +
+                            srcStart.X);
+        };
+
+        // Without transposition, rows are extracted straight into the output
+        VolumeCPUData sub;
+        auto subDat =
+            isIdentityAxis ? AllocOut(roiDim) : sub.Own(rowSz * srcNum.Y * srcNum.Z).GetData();
+        auto extractProgressWeight = isIdentityAxis ? 1.f : .5f;
+        if (File->Mapped.IsMapped())
+            ParallelFor(srcNum.Z, [&](int32 z) {
+                if (isCancelled())
+                    return;
+                for (int32 y = 0; y < srcNum.Y; ++y)
+                    copyRow(subDat + (static_cast<int64>(z) * srcNum.Y + y) * rowSz,
+                            File->Mapped.GetData() + srcRowOffs(y, z));
+                addProgress(extractProgressWeight / srcNum.Z);
+            });
+        else {
+            TArray64<uint8> span;
+            span.SetNumUninitialized(srcRowSpanSz);
+            for (int32 z = 0; z < srcNum.Z; ++z) {
+                if (isCancelled())
+                    break;
+                for (int32 y = 0; y < srcNum.Y; ++y) {
+                    if (!File->Read(srcRowOffs(y, z), span.GetData(), span.Num()))
+                        return RetType(TInPlaceType<FString>(),
+                                       FString::Format(TEXT("Failed to read Desc.FilePath {0}."),
+                                                       {Desc.FilePath.FilePath}));
+                    copyRow(subDat + (static_cast<int64>(z) * srcNum.Y + y) * rowSz,
+                            span.GetData());
+                }
+                addProgress(extractProgressWeight / srcNum.Z);
+            }
+        }
+        if (isCancelled())
+            return cancelledRet();
+
+        if (!isIdentityAxis) {
+            FVolumeTransposer::Exec({.VoxelType = Desc.VoxTy,
+                                     .Axis = Desc.Axis,
+                                     .Dimension = srcNum,
+                                     .Src = sub.GetData(),
+                                     .Dst = AllocOut(roiDim),
+                                     .State = State,
+                                     .ProgressWeight = .5f});
+            if (isCancelled())
+                return cancelledRet();
+        }
+
+        return RetType(TInPlaceType<FIntVector3>(), roiDim);
+    }
+
+    // Map the file so that voxels are streamed from the page cache instead of being copied into a
+    // temporary buffer. Fall back to a plain read on platforms without memory-mapping.
+    VolumeCPUData src;
+    if (!src.MapFile(Desc.FilePath.FilePath) && !src.LoadFile(Desc.FilePath.FilePath))
         return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.FilePath {0}."),
                                                                 {Desc.FilePath.FilePath}));
+    if (isCancelled())
+        return cancelledRet();
+    addProgress(.1f);
+
+    if (src.Num() != volSz)
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Invalid contents in Desc.FilePath {0}."),
+                                       {Desc.FilePath.FilePath}));
+
+    if (isIdentityAxis) {
+        // Fault the pages in here, or copy them into the output if it cannot alias them, so that
+        // later staging does not stall on disk I/O
+        static constexpr int64 ChunkSz = 1 << 24;
+        static constexpr int64 PageSz = 4096;
+        auto dst = AliasOut ? nullptr : AllocOut(Desc.Dimension);
+        if (dst || src.IsMapped()) {
+            auto chunkNum = static_cast<int32>(FMath::DivideAndRoundUp(volSz, ChunkSz));
+            ParallelFor(chunkNum, [&](int32 chunkIdx) {
+                if (isCancelled())
+                    return;
+
+                auto chunkStart = chunkIdx * ChunkSz;
+                auto chunkEnd = std::min(volSz, chunkStart + ChunkSz);
+                auto dat = src.GetData();
+                if (dst)
+                    FMemory::Memcpy(dst + chunkStart, dat + chunkStart, chunkEnd - chunkStart);
+                else {
+                    volatile uint8 sum = 0;
+                    for (auto i = chunkStart; i < chunkEnd; i += PageSz)
+                        sum += dat[i];
+                }
+                addProgress(.9f / chunkNum);
+            });
+            if (isCancelled())
+                return cancelledRet();
+        }
 
-    auto pixFmt = GetVoxelPixelFormat(Desc.VoxTy);
-    auto transform = [&]() {
-        using TrRetType = TVariant<FIntVector3, FString>;
+        // Alias the mapping (or take over the read buffer) instead of copying
+        if (AliasOut)
+            *AliasOut = MoveTemp(src);
+        return RetType(TInPlaceType<FIntVector3>(), Desc.Dimension);
+    }
 
-        if ([&]() {
-                FIntVector3 cnts(0, 0, 0);
-                for (int i = 0; i < 3; ++i)
-                    if (auto j = std::abs(Desc.Axis[i]) - 1; 0 <= j && j <= 2)
-                        ++cnts[j];
-                    else
-                        return true;
-                for (int i = 0; i < 3; ++i)
-                    if (cnts[i] != 1)
-                        return true;
-                return false;
-            }())
-            return TrRetType(TInPlaceType<FString>(),
-                             FString::Format(TEXT("Invalid Desc.Axis {0},{1},{2}."),
-                                             {Desc.Axis[0], Desc.Axis[1], Desc.Axis[2]}));
-
-        if (Desc.Axis == decltype(Desc.Axis)(1, 2, 3))
-            return TrRetType(TInPlaceType<FIntVector3>(), Desc.Dimension);
-
-        FIntVector3 trAxisMap(std::abs(Desc.Axis[0]) - 1, std::abs(Desc.Axis[1]) - 1,
-                              std::abs(Desc.Axis[2]) - 1);
-        FIntVector3 trDim(Desc.Dimension[trAxisMap[0]], Desc.Dimension[trAxisMap[1]],
-                          Desc.Dimension[trAxisMap[2]]);
-
-        decltype(buf) oldBuf = buf;
-        auto trVoxYxX = static_cast<size_t>(trDim.Y) * trDim.X;
-        size_t offs = 0;
-        FIntVector3 coord;
-        for (coord.Z = 0; coord.Z < Desc.Dimension.Z; ++coord.Z)
-            for (coord.Y = 0; coord.Y < Desc.Dimension.Y; ++coord.Y)
-                for (coord.X = 0; coord.X < Desc.Dimension.X; ++coord.X) {
-                    FIntVector3 trCoord(
-                        Desc.Axis.X > 0 ? coord[trAxisMap[0]] : trDim.X - 1 - coord[trAxisMap[0]],
-                        Desc.Axis.Y > 0 ? coord[trAxisMap[1]] : trDim.Y - 1 - coord[trAxisMap[1]],
-                        Desc.Axis.Z > 0 ? coord[trAxisMap[2]] : trDim.Z - 1 - coord[trAxisMap[2]]);
-                    buf[trCoord.Z * trVoxYxX + trCoord.Y * trDim.X + trCoord.X] = oldBuf[offs];
-                    ++offs;
-                }
+    FVolumeTransposer::Exec({.VoxelType = Desc.VoxTy,
+                             .Axis = Desc.Axis,
+                             .Dimension = Desc.Dimension,
+                             .Src = src.GetData(),
+                             .Dst = AllocOut(trDim),
+                             .State = State,
+                             .ProgressWeight = .9f});
+    if (isCancelled())
+        return cancelledRet();
+
+    return RetType(TInPlaceType<FIntVector3>(), trDim);
+}
+
+FArchive &operator<<(FArchive &Ar, VolumeContainerHeader &Header) {
+    auto magic = VolumeContainerHeader::Magic;
+    auto version = VolumeContainerHeader::Version;
+    Ar << magic << version;
+    if (magic != VolumeContainerHeader::Magic || version != VolumeContainerHeader::Version) {
+        Ar.SetError();
+        return Ar;
+    }
+
+    auto voxTy = static_cast<uint8>(Header.VoxTy);
+    auto compressionFormat = Header.CompressionFormat.ToString();
+    Ar << voxTy << Header.Axis << Header.Dimension << Header.BrickSize << compressionFormat
+       << Header.LongtitudeRange << Header.LatitudeRange << Header.HeightRange << Header.Bricks;
+    if (Ar.IsLoading()) {
+        Header.VoxTy = static_cast<ESupportedVoxelType>(voxTy);
+        Header.CompressionFormat = FName(compressionFormat);
+        Header.PayloadOffset = Ar.Tell();
+    }
+
+    return Ar;
+}
+
+TVariant<VolumeContainerHeader, FString>
+VolumeData::LoadContainerHeaderFromFile(const FFilePath &FilePath) {
+    using RetType = TVariant<VolumeContainerHeader, FString>;
 
-        return TrRetType(TInPlaceType<FIntVector3>(), trDim);
+    TUniquePtr<FArchive> ar(IFileManager::Get().CreateFileReader(*FilePath.FilePath));
+    if (!ar.IsValid())
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Invalid FilePath {0}."), {FilePath.FilePath}));
+
+    VolumeContainerHeader header;
+    *ar << header;
+
+    auto invalidRet = [&]() {
+        return RetType(
+            TInPlaceType<FString>(),
+            FString::Format(TEXT("Invalid contents in FilePath {0}."), {FilePath.FilePath}));
     };
+    auto brickNum = header.GetBrickNum();
+    if (ar->IsError() || GetVoxelSize(header.VoxTy) == 0 || header.Dimension.X <= 0 ||
+        header.Dimension.Y <= 0 || header.Dimension.Z <= 0 || header.BrickSize <= 0 ||
+        !FCompression::IsFormatValid(header.CompressionFormat) ||
+        header.Bricks.Num() != brickNum.X * brickNum.Y * brickNum.Z)
+        return invalidRet();
+
+    auto voxSz = static_cast<int64>(GetVoxelSize(header.VoxTy));
+    auto payloadSz = ar->TotalSize() - header.PayloadOffset;
+    FIntVector3 brickCoord;
+    for (brickCoord.Z = 0; brickCoord.Z < brickNum.Z; ++brickCoord.Z)
+        for (brickCoord.Y = 0; brickCoord.Y < brickNum.Y; ++brickCoord.Y)
+            for (brickCoord.X = 0; brickCoord.X < brickNum.X; ++brickCoord.X) {
+                auto &brick = header.Bricks[header.GetBrickIndex(brickCoord)];
+                auto [min, max] = header.GetBrickVoxelRange(brickCoord);
+                auto brickDim = max - min;
+                if (brick.Offset < 0 || brick.CompressedSize <= 0 ||
+                    brick.Offset + brick.CompressedSize > payloadSz ||
+                    brick.UncompressedSize != voxSz * brickDim.X * brickDim.Y * brickDim.Z)
+                    return invalidRet();
+            }
 
-    auto load = [&]<SupportedVoxelType T>(T *dat) -> RetType {
-        auto volSz = sizeof(T) * Desc.Dimension.X * Desc.Dimension.Y * Desc.Dimension.Z;
+    return RetType(TInPlaceType<VolumeContainerHeader>(), MoveTemp(header));
+}
 
-        if (buf.Num() != volSz)
-            return RetType(TInPlaceType<FString>(),
-                           FString::Format(TEXT("Invalid contents in Desc.FilePath {0}."),
-                                           {Desc.FilePath.FilePath}));
-        FIntVector3 trDim;
-        if (auto ret = transform(); ret.IsType<FString>())
-            return RetType(TInPlaceType<FString>(), ret.Get<FString>());
-        else
-            trDim = ret.Get<FIntVector3>();
+TOptional<FString> VolumeData::SaveCPUDataToContainer(const VolumeCPUData &VolDat,
+                                                      const VolumeContainerHeader &Header,
+                                                      const FFilePath &FilePath,
+                                                      LoadFromFileState *State) {
+    auto voxSz = static_cast<int64>(GetVoxelSize(Header.VoxTy));
+    if (voxSz == 0)
+        return FString("Invalid Header.VoxTy.");
+    if (Header.Dimension.X <= 0 || Header.Dimension.Y <= 0 || Header.Dimension.Z <= 0)
+        return FString::Format(TEXT("Invalid Header.Dimension {0}."),
+                               {Header.Dimension.ToString()});
+    // Keep the size of a brick in int32
+    if (Header.BrickSize < 8 || Header.BrickSize > 512)
+        return FString::Format(TEXT("Invalid Header.BrickSize {0}."), {Header.BrickSize});
+    if (!FCompression::IsFormatValid(Header.CompressionFormat))
+        return FString::Format(TEXT("Invalid Header.CompressionFormat {0}."),
+                               {Header.CompressionFormat.ToString()});
+    if (VolDat.Num() != voxSz * Header.Dimension.X * Header.Dimension.Y * Header.Dimension.Z)
+        return FString::Format(TEXT("Size of VolDat {0} is not the same as Header.Dimension {1}."),
+                               {VolDat.Num(), Header.Dimension.ToString()});
+
+    auto isCancelled = [&]() { return State && State->Cancelled; };
+
+    auto header = Header;
+    auto brickNum = header.GetBrickNum();
+    header.Bricks.SetNum(brickNum.X * brickNum.Y * brickNum.Z);
+
+    // Bricks are compressed in parallel and kept in memory until they are written in order
+    TArray<TArray<uint8>> payloads;
+    payloads.SetNum(header.Bricks.Num());
+    ParallelFor(header.Bricks.Num(), [&](int32 brickIdx) {
+        if (isCancelled())
+            return;
+
+        FIntVector3 brickCoord(brickIdx % brickNum.X, brickIdx / brickNum.X % brickNum.Y,
+                               brickIdx / (brickNum.X * brickNum.Y));
+        auto [min, max] = header.GetBrickVoxelRange(brickCoord);
+        auto brickDim = max - min;
+        auto rowSz = voxSz * brickDim.X;
+
+        TArray<uint8> raw;
+        raw.SetNumUninitialized(rowSz * brickDim.Y * brickDim.Z);
+        for (int32 z = 0; z < brickDim.Z; ++z)
+            for (int32 y = 0; y < brickDim.Y; ++y)
+                FMemory::Memcpy(raw.GetData() + (z * brickDim.Y + y) * rowSz,
+                                VolDat.GetData() +
+                                    voxSz * ((static_cast<int64>(min.Z + z) * Header.Dimension.Y +
+                                              min.Y + y) *
+                                                 Header.Dimension.X +
+                                             min.X),
+                                rowSz);
+
+        auto &brick = header.Bricks[brickIdx];
+        auto &payload = payloads[brickIdx];
+        brick.UncompressedSize = raw.Num();
+        brick.CompressedSize =
+            FCompression::CompressMemoryBound(header.CompressionFormat, brick.UncompressedSize);
+        payload.SetNumUninitialized(brick.CompressedSize);
+        if (FCompression::CompressMemory(header.CompressionFormat, payload.GetData(),
+                                         brick.CompressedSize, raw.GetData(), raw.Num()) &&
+            brick.CompressedSize < brick.UncompressedSize)
+            payload.SetNum(brick.CompressedSize, false);
+        else {
+            // Incompressible bricks are stored as is
+            payload = MoveTemp(raw);
+            brick.CompressedSize = brick.UncompressedSize;
+        }
 
-        auto tex = UVolumeTexture::CreateTransient(trDim.X, trDim.Y, trDim.Z, pixFmt, Desc.Name);
-        tex->Filter = TextureFilter::TF_Trilinear;
-        tex->AddressMode = TextureAddress::TA_Clamp;
+        if (State)
+            State->Progress += .9f / header.Bricks.Num();
+    });
+    if (isCancelled())
+        return FString("Cancelled.");
 
-        auto *texDat =
-            tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
-        FMemory::Memcpy(texDat, dat, volSz);
-        tex->GetPlatformData()->Mips[0].BulkData.Unlock();
+    int64 offs = 0;
+    for (auto &brick : header.Bricks) {
+        brick.Offset = offs;
+        offs += brick.CompressedSize;
+    }
 
-        tex->UpdateResource();
+    TUniquePtr<FArchive> ar(IFileManager::Get().CreateFileWriter(*FilePath.FilePath));
+    if (!ar.IsValid())
+        return FString::Format(TEXT("Invalid FilePath {0}."), {FilePath.FilePath});
 
-        if (VolumeOut.IsSet())
-            VolumeOut->get() = std::move(buf);
+    *ar << header;
+    for (auto &payload : payloads)
+        ar->Serialize(payload.GetData(), payload.Num());
+    if (!ar->Close())
+        return FString::Format(TEXT("Failed to write FilePath {0}."), {FilePath.FilePath});
 
-        return RetType(TInPlaceType<UVolumeTexture *>(), tex);
+    if (State)
+        State->Progress += .1f;
+    return {};
+}
+
+TVariant<FIntVector3, FString>
+VolumeData::loadCPUDataFromContainer(const LoadFromFileDesc &Desc, const FIntVector3 &ROIMax,
+                                     const OpenedFile &File,
+                                     TFunctionRef<uint8 *(const FIntVector3 &)> AllocOut,
+                                     LoadFromFileState *State) {
+    using RetType = TVariant<FIntVector3, FString>;
+
+    auto &header = *File.ContainerHeader;
+    if (Desc.VoxTy != header.VoxTy || Desc.Dimension != header.Dimension ||
+        Desc.Axis != FIntVector3(1, 2, 3))
+        return RetType(
+            TInPlaceType<FString>(),
+            FString::Format(TEXT("Desc does not match the container header in Desc.FilePath {0}."),
+                            {Desc.FilePath.FilePath}));
+
+    auto isCancelled = [&]() { return State && State->Cancelled; };
+    auto cancelledRet = [&]() { return RetType(TInPlaceType<FString>(), TEXT("Cancelled.")); };
+    auto addProgress = [&](float dlt) {
+        if (State)
+            State->Progress += dlt;
     };
 
-    switch (Desc.VoxTy) {
-    case ESupportedVoxelType::UInt8:
-        return load(reinterpret_cast<uint8 *>(buf.GetData()));
-    case ESupportedVoxelType::UInt16:
-        return load(reinterpret_cast<uint16 *>(buf.GetData()));
-    case ESupportedVoxelType::Float32:
-        return load(reinterpret_cast<float *>(buf.GetData()));
-    default:
-        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    auto voxSz = static_cast<int64>(GetVoxelSize(header.VoxTy));
+    FIntVector3 roiDim;
+    for (int32 i = 0; i < 3; ++i)
+        roiDim[i] = FMath::DivideAndRoundUp(ROIMax[i] - Desc.ROIMin[i], Desc.ROIStride[i]);
+
+    // Indices range [Min, Max) of voxels sampled in the ROI, which lie in a brick along an axis
+    auto getSampledRange = [&](int32 axis, int32 brickCoord) {
+        auto brickMin = brickCoord * header.BrickSize;
+        auto brickMax = std::min(brickMin + header.BrickSize, header.Dimension[axis]);
+        auto min = FMath::DivideAndRoundUp(brickMin - Desc.ROIMin[axis], Desc.ROIStride[axis]);
+        auto max = FMath::DivideAndRoundUp(brickMax - Desc.ROIMin[axis], Desc.ROIStride[axis]);
+        return MakeTuple(std::max(0, min), std::min(roiDim[axis], max));
+    };
+
+    // Only bricks with sampled voxels are read
+    TArray<FIntVector3> brickCoords;
+    {
+        FIntVector3 brickCoord;
+        for (brickCoord.Z = Desc.ROIMin.Z / header.BrickSize;
+             brickCoord.Z <= (ROIMax.Z - 1) / header.BrickSize; ++brickCoord.Z)
+            for (brickCoord.Y = Desc.ROIMin.Y / header.BrickSize;
+                 brickCoord.Y <= (ROIMax.Y - 1) / header.BrickSize; ++brickCoord.Y)
+                for (brickCoord.X = Desc.ROIMin.X / header.BrickSize;
+                     brickCoord.X <= (ROIMax.X - 1) / header.BrickSize; ++brickCoord.X)
+                    if ([&]() {
+                            for (int32 i = 0; i < 3; ++i)
+                                if (auto [min, max] = getSampledRange(i, brickCoord[i]); min >= max)
+                                    return false;
+                            return true;
+                        }())
+                        brickCoords.Emplace(brickCoord);
     }
+
+    // Decompress bricks straight from the mapping. Without memory-mapping, read the needed bricks
+    // in order on this thread first.
+    TArray<TArray<uint8>> payloads;
+    auto decompressProgressWeight = 1.f;
+    if (!File.Mapped.IsMapped()) {
+        decompressProgressWeight = .5f;
+        payloads.SetNum(brickCoords.Num());
+        for (int32 i = 0; i < brickCoords.Num(); ++i) {
+            if (isCancelled())
+                return cancelledRet();
+
+            auto &brick = header.Bricks[header.GetBrickIndex(brickCoords[i])];
+            payloads[i].SetNumUninitialized(brick.CompressedSize);
+            if (!File.Read(header.PayloadOffset + brick.Offset, payloads[i].GetData(),
+                           brick.CompressedSize))
+                return RetType(TInPlaceType<FString>(),
+                               FString::Format(TEXT("Failed to read Desc.FilePath {0}."),
+                                               {Desc.FilePath.FilePath}));
+            addProgress(.5f / brickCoords.Num());
+        }
+    }
+
+    auto dst = AllocOut(roiDim);
+    std::atomic<bool> failed = false;
+    ParallelFor(brickCoords.Num(), [&](int32 i) {
+        if (failed || isCancelled())
+            return;
+
+        auto &brickCoord = brickCoords[i];
+        auto &brick = header.Bricks[header.GetBrickIndex(brickCoord)];
+        auto brickDat = File.Mapped.IsMapped()
+                            ? File.Mapped.GetData() + header.PayloadOffset + brick.Offset
+                            : payloads[i].GetData();
+
+        TArray<uint8> raw;
+        if (brick.CompressedSize != brick.UncompressedSize) {
+            raw.SetNumUninitialized(brick.UncompressedSize);
+            if (!FCompression::UncompressMemory(header.CompressionFormat, raw.GetData(),
+                                                raw.Num(), brickDat, brick.CompressedSize)) {
+                failed = true;
+                return;
+            }
+            brickDat = raw.GetData();
+        }
+
+        auto [brickMin, brickMax] = header.GetBrickVoxelRange(brickCoord);
+        auto brickDim = brickMax - brickMin;
+        FIntVector3 smplMin, smplMax;
+        for (int32 j = 0; j < 3; ++j)
+            Tie(smplMin[j], smplMax[j]) = getSampledRange(j, brickCoord[j]);
+
+        auto smplNumX = smplMax.X - smplMin.X;
+        auto srcX = Desc.ROIMin.X + smplMin.X * Desc.ROIStride.X - brickMin.X;
+        for (int32 z = smplMin.Z; z < smplMax.Z; ++z)
+            for (int32 y = smplMin.Y; y < smplMax.Y; ++y) {
+                auto srcY = Desc.ROIMin.Y + y * Desc.ROIStride.Y - brickMin.Y;
+                auto srcZ = Desc.ROIMin.Z + z * Desc.ROIStride.Z - brickMin.Z;
+                auto srcRow =
+                    brickDat +
+                    voxSz * ((static_cast<int64>(srcZ) * brickDim.Y + srcY) * brickDim.X + srcX);
+                auto dstRow =
+                    dst + voxSz * ((static_cast<int64>(z) * roiDim.Y + y) * roiDim.X + smplMin.X);
+                if (Desc.ROIStride.X == 1)
+                    FMemory::Memcpy(dstRow, srcRow, voxSz * smplNumX);
+                else
+                    for (int32 x = 0; x < smplNumX; ++x)
+                        FMemory::Memcpy(dstRow + x * voxSz, srcRow + x * Desc.ROIStride.X * voxSz,
+                                        voxSz);
+            }
+
+        addProgress(decompressProgressWeight / brickCoords.Num());
+    });
+    if (failed)
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Failed to decompress bricks in Desc.FilePath {0}."),
+                                       {Desc.FilePath.FilePath}));
+    if (isCancelled())
+        return cancelledRet();
+
+    return RetType(TInPlaceType<FIntVector3>(), roiDim);
+}
+
+UVolumeTexture *VolumeData::CreateTextureFromCPUData(const VolumeCPUData &VolDat,
+                                                     ESupportedVoxelType VoxTy,
+                                                     const FIntVector3 &Dimension,
+                                                     const FName &Name) {
+    auto tex = createTransientTexture(VoxTy, Dimension, Name);
+    auto *texDat =
+        tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
+    FMemory::Memcpy(texDat, VolDat.GetData(), VolDat.Num());
+    tex->GetPlatformData()->Mips[0].BulkData.Unlock();
+
+    tex->UpdateResource();
+
+    return tex;
+}
+
+UVolumeTexture *VolumeData::createTransientTexture(ESupportedVoxelType VoxTy,
+                                                   const FIntVector3 &Dimension,
+                                                   const FName &Name) {
+    auto tex = UVolumeTexture::CreateTransient(Dimension.X, Dimension.Y, Dimension.Z,
+                                               GetVoxelPixelFormat(VoxTy), Name);
+    tex->Filter = TextureFilter::TF_Trilinear;
+    tex->AddressMode = TextureAddress::TA_Clamp;
+
+    return tex;
 }
 
 TVariant<UVolumeTexture *, FString>
@@ -112,94 +673,71 @@ VolumeData::SmoothFromFlatArray(const SmoothFromFlatArrayDesc &Desc,
                                 TOptional<std::reference_wrapper<TArray<uint8>>> SmoothedVolOut) {
     using RetType = TVariant<UVolumeTexture *, FString>;
 
-    auto voxPerVolYxX = static_cast<uint64>(Desc.Dimension.Y) * Desc.Dimension.X;
+    auto voxNum = static_cast<int64>(Desc.Dimension.X) * Desc.Dimension.Y * Desc.Dimension.Z;
+    auto volSz = GetVoxelSize(Desc.VoxTy) * voxNum;
+    if (volSz == 0)
+        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    if (Desc.Radius < 0)
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Invalid Desc.Radius {0}."), {Desc.Radius}));
+    if (Desc.VolDat.Num() != volSz)
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(
+                           TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
+                           {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
 
     TArray<uint8> buf;
-    buf.SetNum(Desc.VolDat.Num());
-
-    auto smoothKernelMax = [&]<SupportedVoxelType T>(const T *dat, const FIntVector3 &pos) -> T {
-        auto scalar = std::numeric_limits<T>::min();
-        FIntVector3 dPos(pos.X == 0 ? 0 : -1, pos.Y == 0 ? 0 : -1,
-                         Desc.SmoothDim == EVolumeSmoothDimension::XY || pos.Z == 0 ? 0 : -1);
-        for (; dPos.Z <
-               (Desc.SmoothDim == EVolumeSmoothDimension::XY || pos.Z == Desc.Dimension.Z - 1 ? 1
-                                                                                              : 2);
-             ++dPos.Z)
-            for (; dPos.Y < (pos.Y == Desc.Dimension.Y - 1 ? 1 : 2); ++dPos.Y)
-                for (; dPos.X < (pos.X == Desc.Dimension.X - 1 ? 1 : 2); ++dPos.X) {
-                    auto newPos = pos + dPos;
-                    scalar = std::max(
-                        scalar,
-                        dat[newPos.Z * voxPerVolYxX + newPos.Y * Desc.Dimension.X + newPos.X]);
-                }
-        return scalar;
-    };
-    auto smoothKernelAvg = [&]<SupportedVoxelType T>(const T *dat, const FIntVector3 &pos) -> T {
-        float scalar = 0.f;
-        int32 num = 0.f;
-        FIntVector3 dPos(pos.X == 0 ? 0 : -1, pos.Y == 0 ? 0 : -1,
-                         Desc.SmoothDim != EVolumeSmoothDimension::XY || pos.Z == 0 ? 0 : -1);
-        for (; dPos.Z <
-               (Desc.SmoothDim != EVolumeSmoothDimension::XY || pos.Z == Desc.Dimension.Z - 1 ? 1
-                                                                                              : 2);
-             ++dPos.Z)
-            for (; dPos.Y < (pos.Y == Desc.Dimension.Y - 1 ? 1 : 2); ++dPos.Y)
-                for (; dPos.X < (pos.X == Desc.Dimension.X - 1 ? 1 : 2); ++dPos.X) {
-                    auto newPos = pos + dPos;
-                    scalar += dat[newPos.Z * voxPerVolYxX + newPos.Y * Desc.Dimension.X + newPos.X];
-                    ++num;
-                }
-        if constexpr (std::is_floating_point_v<T>)
-            return scalar / num;
-        else
-            return static_cast<T>(std::roundf(scalar / num));
-    };
-    auto smooth = [&]<SupportedVoxelType T>(T *newDat, const T *oldDat) -> RetType {
-        int32 idx = 0;
-        FIntVector3 pos;
-        for (pos.Z = 0; pos.Z < Desc.Dimension.Z; ++pos.Z)
-            for (pos.Y = 0; pos.Y < Desc.Dimension.Y; ++pos.Y)
-                for (pos.X = 0; pos.X < Desc.Dimension.X; ++pos.X) {
-                    newDat[idx] = Desc.SmoothTy == EVolumeSmoothType::Avg
-                                      ? smoothKernelAvg(oldDat, pos)
-                                      : smoothKernelMax(oldDat, pos);
-                    ++idx;
-                }
+    buf.SetNumUninitialized(Desc.VolDat.Num());
+    FVolumeSmootherCPU::Exec({.SmoothType = Desc.SmoothTy,
+                              .SmoothDimension = Desc.SmoothDim,
+                              .Radius = Desc.Radius,
+                              .VoxelType = Desc.VoxTy,
+                              .Dimension = Desc.Dimension,
+                              .Src = Desc.VolDat.GetData(),
+                              .Dst = buf.GetData()});
+
+    auto tex = UVolumeTexture::CreateTransient(Desc.Dimension.X, Desc.Dimension.Y,
+                                               Desc.Dimension.Z, GetVoxelPixelFormat(Desc.VoxTy),
+                                               Desc.Name);
+    tex->Filter = TextureFilter::TF_Trilinear;
+    tex->AddressMode = TextureAddress::TA_Clamp;
 
-        auto volSz = sizeof(T) * Desc.Dimension.X * Desc.Dimension.Y * Desc.Dimension.Z;
-        if (Desc.VolDat.Num() != volSz)
-            return RetType(
-                TInPlaceType<FString>(),
-                FString::Format(
-                    TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
-                    {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
-
-        auto tex =
-            UVolumeTexture::CreateTransient(Desc.Dimension.X, Desc.Dimension.Y, Desc.Dimension.Z,
-                                            GetVoxelPixelFormat(Desc.VoxTy), Desc.Name);
-        tex->Filter = TextureFilter::TF_Trilinear;
-        tex->AddressMode = TextureAddress::TA_Clamp;
-
-        auto *texDat =
-            tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
-        FMemory::Memcpy(texDat, newDat, volSz);
-        tex->GetPlatformData()->Mips[0].BulkData.Unlock();
+    auto *texDat =
+        tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
+    FMemory::Memcpy(texDat, buf.GetData(), volSz);
+    tex->GetPlatformData()->Mips[0].BulkData.Unlock();
 
-        tex->UpdateResource();
+    tex->UpdateResource();
 
-        if (SmoothedVolOut.IsSet())
-            SmoothedVolOut->get() = std::move(buf);
+    if (SmoothedVolOut.IsSet())
+        SmoothedVolOut->get() = std::move(buf);
 
-        return RetType(TInPlaceType<UVolumeTexture *>(), tex);
-    };
+    return RetType(TInPlaceType<UVolumeTexture *>(), tex);
+}
 
-    switch (Desc.VoxTy) {
-    case ESupportedVoxelType::UInt8:
-        return smooth(reinterpret_cast<uint8 *>(buf.GetData()),
-                      reinterpret_cast<const uint8 *>(Desc.VolDat.GetData()));
-    default:
-        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
-    }
+TOptional<FString> VolumeData::SmoothCPUData(const SmoothCPUDataDesc &Desc,
+                                             const VolumeCPUData &VolDat,
+                                             VolumeCPUData &SmoothedVolOut) {
+    auto voxNum = static_cast<int64>(Desc.Dimension.X) * Desc.Dimension.Y * Desc.Dimension.Z;
+    auto volSz = static_cast<int64>(GetVoxelSize(Desc.VoxTy)) * voxNum;
+    if (volSz == 0)
+        return FString("Invalid Desc.VoxTy or Desc.Dimension.");
+    if (Desc.Radius < 0)
+        return FString::Format(TEXT("Invalid Desc.Radius {0}."), {Desc.Radius});
+    if (VolDat.Num() != volSz)
+        return FString::Format(TEXT("Size of VolDat {0} is not the same as Desc.Dimension {1}."),
+                               {VolDat.Num(), Desc.Dimension.ToString()});
+
+    auto &smoothed = SmoothedVolOut.Own(volSz);
+    FVolumeSmootherCPU::Exec({.SmoothType = Desc.SmoothTy,
+                              .SmoothDimension = Desc.SmoothDim,
+                              .Radius = Desc.Radius,
+                              .VoxelType = Desc.VoxTy,
+                              .Dimension = Desc.Dimension,
+                              .Src = VolDat.GetData(),
+                              .Dst = smoothed.GetData()});
+
+    return {};
 }
 
 TVariant<TTuple<UTexture2D *, UCurveLinearColor *>, FString>
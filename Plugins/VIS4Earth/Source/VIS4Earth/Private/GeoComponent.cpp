@@ -9,6 +9,8 @@
 #include "StaticMeshAttributes.h"
 #include "Widgets/Notifications/SNotificationList.h"
 
+#include "GeoTransformer.h"
+
 void UGeoComponent::checkAndCorrectParameters() {
     if (LongtitudeRange[0] < -180.)
         LongtitudeRange[0] = -180.;
@@ -70,6 +72,19 @@ TOptional<UGeoComponent::GeoMesh> UGeoComponent::GenerateGeoMesh(int32 Longtitud
         return {};
     }
 
+    auto ret = FGeoTransformer::Create(
+        {.LongtitudeRange = LongtitudeRange,
+         .LatitudeRange = LatitudeRange,
+         .HeightRange = HeightRange,
+         .Dimension = {std::max(LongtitudeTessellation - 1, 1),
+                       std::max(LatitudeTessellation - 1, 1), 1},
+         .GeoRef = GeoRef});
+    if (ret.IsType<FString>()) {
+        processError(ret.Get<FString>());
+        return {};
+    }
+    auto &transformer = ret.Get<TSharedRef<FGeoTransformer>>().Get();
+
     GeoMesh result;
     auto &positions = result.Positions;
     auto &texCoordXYs = result.TexCoordXYs;
@@ -78,13 +93,8 @@ TOptional<UGeoComponent::GeoMesh> UGeoComponent::GenerateGeoMesh(int32 Longtitud
 
     int btmSurfVertStart;
     {
-        auto lonExt = LongtitudeRange[1] - LongtitudeRange[0];
-        auto latExt = LatitudeRange[1] - LatitudeRange[0];
-        auto lonDlt = lonExt / LongtitudeTessellation;
-        auto latDlt = latExt / LatitudeTessellation;
-
+        // On the grid of the transformer, to be transformed at once
         auto genSurfVertices = [&](bool top) {
-            auto h = top ? HeightRange[1] : HeightRange[0];
             for (int latIdx = 0; latIdx < LatitudeTessellation; ++latIdx)
                 for (int lonIdx = 0; lonIdx < LongtitudeTessellation; ++lonIdx) {
                     texCoordXYs.Emplace();
@@ -93,18 +103,16 @@ TOptional<UGeoComponent::GeoMesh> UGeoComponent::GenerateGeoMesh(int32 Longtitud
                     texCoordZs.Emplace();
                     texCoordZs.Last().X = 1. * latIdx / (LatitudeTessellation - 1);
                     texCoordZs.Last().Y = 0.;
-
-                    auto lon = LongtitudeRange[0] + texCoordXYs.Last().X * lonExt;
-                    auto lat = LatitudeRange[0] + texCoordZs.Last().X * latExt;
                     texCoordZs.Last().X = 1.f - texCoordZs.Last().X;
 
-                    positions.Emplace(
-                        GeoRef->TransformLongitudeLatitudeHeightPositionToUnreal({lon, lat, h}));
+                    positions.Emplace(lonIdx, latIdx, top ? 1. : 0.);
                 }
         };
         genSurfVertices(true);
         btmSurfVertStart = positions.Num();
         genSurfVertices(false);
+
+        transformer.Transform(positions);
     }
 
     {
@@ -152,6 +160,32 @@ TOptional<UGeoComponent::GeoMesh> UGeoComponent::GenerateGeoMesh(int32 Longtitud
     return result;
 }
 
+TTuple<FIntVector3, FIntVector3> UGeoComponent::GetVoxelROI(const FVector2D &FullLongtitudeRange,
+                                                            const FVector2D &FullLatitudeRange,
+                                                            const FVector2D &FullHeightRange,
+                                                            const FIntVector3 &Dimension) const {
+    std::array fullRngs = {&FullLongtitudeRange, &FullLatitudeRange, &FullHeightRange};
+    std::array rngs = {&LongtitudeRange, &LatitudeRange, &HeightRange};
+
+    FIntVector3 roiMin, roiMax;
+    for (int32 i = 0; i < 3; ++i) {
+        auto ext = (*fullRngs[i])[1] - (*fullRngs[i])[0];
+        if (ext <= 0.) {
+            roiMin[i] = 0;
+            roiMax[i] = Dimension[i];
+            continue;
+        }
+
+        auto toVoxel = [&](double val) { return ((val - (*fullRngs[i])[0]) / ext) * Dimension[i]; };
+        roiMin[i] = std::clamp(static_cast<int32>(std::floor(toVoxel((*rngs[i])[0]))), 0,
+                               Dimension[i] - 1);
+        roiMax[i] = std::clamp(static_cast<int32>(std::ceil(toVoxel((*rngs[i])[1]))),
+                               roiMin[i] + 1, Dimension[i]);
+    }
+
+    return MakeTuple(roiMin, roiMax);
+}
+
 struct GeoComponentNamesInUI {
     static constexpr std::array LongtitudeRange = {TEXT("EditableText_LongtitudeRangeMin"),
                                                    TEXT("EditableText_LongtitudeRangeMax")};
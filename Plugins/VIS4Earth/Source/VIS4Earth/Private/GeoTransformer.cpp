@@ -0,0 +1,163 @@
+#include "GeoTransformer.h"
+
+#include <array>
+
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+
+namespace {
+
+// Of WGS84 in meters
+constexpr double EarthLong = 6378137.;
+constexpr double EarthShort = 6356752.3142451793;
+
+void GetSinCos(double &Sin, double &Cos, double GridCoord, const TArray<FVector2D> &SinCoss,
+               double Min, double Delta) {
+    if (auto idx = static_cast<int32>(GridCoord); idx == GridCoord && SinCoss.IsValidIndex(idx)) {
+        Sin = SinCoss[idx].X;
+        Cos = SinCoss[idx].Y;
+        return;
+    }
+
+    auto rad = Min + GridCoord * Delta;
+    Sin = std::sin(rad);
+    Cos = std::cos(rad);
+}
+
+} // namespace
+
+TVariant<TSharedRef<FGeoTransformer>, FString>
+FGeoTransformer::Create(const Parameters &Params) {
+    using RetType = TVariant<TSharedRef<FGeoTransformer>, FString>;
+
+    if (!Params.GeoRef.IsValid())
+        return RetType(TInPlaceType<FString>(), TEXT("GeoRef is NOT set."));
+    for (int32 i = 0; i < 3; ++i)
+        if (Params.Dimension[i] <= 0)
+            return RetType(TInPlaceType<FString>(),
+                           FString::Format(TEXT("Invalid Params.Dimension {0}."),
+                                           {Params.Dimension.ToString()}));
+
+    TSharedRef<FGeoTransformer> transformer = MakeShareable(new FGeoTransformer(Params));
+
+    // Validate on corners and the center of the grid
+    for (int32 i = 0; i < 9; ++i) {
+        auto gridPos = i == 8 ? .5 * FVector(Params.Dimension)
+                              : FVector(i & 0b001 ? Params.Dimension.X : 0,
+                                        i & 0b010 ? Params.Dimension.Y : 0,
+                                        i & 0b100 ? Params.Dimension.Z : 0);
+        if (FVector::Dist(transformer->Transform(gridPos),
+                          transformer->transformByGeoRef(gridPos)) >= MaxError) {
+            transformer->isOnWGS84 = false;
+            break;
+        }
+    }
+
+    return RetType(TInPlaceType<TSharedRef<FGeoTransformer>>(), transformer);
+}
+
+FGeoTransformer::FGeoTransformer(const Parameters &Params)
+    : mins(FMath::DegreesToRadians(Params.LongtitudeRange[0]),
+           FMath::DegreesToRadians(Params.LatitudeRange[0]), Params.HeightRange[0]),
+      deltas(FMath::DegreesToRadians(Params.LongtitudeRange[1] - Params.LongtitudeRange[0]) /
+                 Params.Dimension.X,
+             FMath::DegreesToRadians(Params.LatitudeRange[1] - Params.LatitudeRange[0]) /
+                 Params.Dimension.Y,
+             (Params.HeightRange[1] - Params.HeightRange[0]) / Params.Dimension.Z),
+      ecefToUnreal(Params.GeoRef->ComputeEarthCenteredEarthFixedToUnrealTransformation()),
+      geoRef(Params.GeoRef) {
+    lonSinCoss.SetNumUninitialized(Params.Dimension.X + 1);
+    for (int32 x = 0; x <= Params.Dimension.X; ++x)
+        FMath::SinCos(&lonSinCoss[x].X, &lonSinCoss[x].Y, mins.X + x * deltas.X);
+    latSinCoss.SetNumUninitialized(Params.Dimension.Y + 1);
+    for (int32 y = 0; y <= Params.Dimension.Y; ++y)
+        FMath::SinCos(&latSinCoss[y].X, &latSinCoss[y].Y, mins.Y + y * deltas.Y);
+}
+
+FVector FGeoTransformer::Transform(const FVector &GridPos) const {
+    if (!isOnWGS84)
+        return transformByGeoRef(GridPos);
+
+    double sinLon, cosLon, sinLat, cosLat;
+    GetSinCos(sinLon, cosLon, GridPos.X, lonSinCoss, mins.X, deltas.X);
+    GetSinCos(sinLat, cosLat, GridPos.Y, latSinCoss, mins.Y, deltas.Y);
+    auto h = mins.Z + GridPos.Z * deltas.Z;
+
+    // ECEF = RadiiSqr * N / sqrt(N . RadiiSqr * N) + H * N, where N is the geodetic normal
+    static const auto RadiiSqr = MakeVectorRegisterDouble(EarthLong * EarthLong,
+                                                          EarthLong * EarthLong,
+                                                          EarthShort * EarthShort, 0.);
+    auto invGamma = 1. / FMath::Sqrt(EarthLong * EarthLong * cosLat * cosLat +
+                                     EarthShort * EarthShort * sinLat * sinLat);
+    auto n = MakeVectorRegisterDouble(cosLat * cosLon, cosLat * sinLon, sinLat, 0.);
+    auto ecef = VectorMultiplyAdd(VectorMultiply(RadiiSqr, n), VectorSetFloat1(invGamma),
+                                  VectorMultiply(n, VectorSetFloat1(h)));
+
+    // Row vector times the matrix, as FMatrix::TransformPosition
+    auto ret = VectorMultiplyAdd(
+        VectorReplicate(ecef, 0), VectorLoad(ecefToUnreal.M[0]),
+        VectorMultiplyAdd(VectorReplicate(ecef, 1), VectorLoad(ecefToUnreal.M[1]),
+                          VectorMultiplyAdd(VectorReplicate(ecef, 2),
+                                            VectorLoad(ecefToUnreal.M[2]),
+                                            VectorLoad(ecefToUnreal.M[3]))));
+
+    FVector unreal;
+    VectorStoreFloat3(ret, &unreal.X);
+    return unreal;
+}
+
+void FGeoTransformer::Transform(TArrayView<FVector> GridPositions) const {
+    static constexpr int32 BatchSize = 4096;
+
+    // The georeference is a UObject, which workers must not read
+    if (!isOnWGS84) {
+        for (auto &gridPos : GridPositions)
+            gridPos = transformByGeoRef(gridPos);
+        return;
+    }
+
+    ParallelFor(FMath::DivideAndRoundUp(GridPositions.Num(), BatchSize), [&](int32 batchIdx) {
+        auto end = std::min((batchIdx + 1) * BatchSize, GridPositions.Num());
+        for (int32 i = batchIdx * BatchSize; i < end; ++i)
+            GridPositions[i] = Transform(GridPositions[i]);
+    });
+}
+
+FVector FGeoTransformer::TransformNormal(const FVector &GridPos, const FVector &GridNormal) const {
+    // Columns of the Jacobian by forward differences over a cell
+    auto pos = Transform(GridPos);
+    std::array<FVector, 3> jacobian;
+    for (int32 i = 0; i < 3; ++i) {
+        auto next = GridPos;
+        next[i] += 1.;
+        jacobian[i] = Transform(next) - pos;
+    }
+
+    return (GridNormal.X * FVector::CrossProduct(jacobian[1], jacobian[2]) +
+            GridNormal.Y * FVector::CrossProduct(jacobian[2], jacobian[0]) +
+            GridNormal.Z * FVector::CrossProduct(jacobian[0], jacobian[1]))
+        .GetSafeNormal();
+}
+
+void FGeoTransformer::TransformNormals(TArrayView<const FVector> GridPositions,
+                                       TArrayView<FVector> GridNormals) const {
+    static constexpr int32 BatchSize = 4096;
+
+    if (!isOnWGS84) {
+        for (int32 i = 0; i < GridNormals.Num(); ++i)
+            GridNormals[i] = TransformNormal(GridPositions[i], GridNormals[i]);
+        return;
+    }
+
+    ParallelFor(FMath::DivideAndRoundUp(GridNormals.Num(), BatchSize), [&](int32 batchIdx) {
+        auto end = std::min((batchIdx + 1) * BatchSize, GridNormals.Num());
+        for (int32 i = batchIdx * BatchSize; i < end; ++i)
+            GridNormals[i] = TransformNormal(GridPositions[i], GridNormals[i]);
+    });
+}
+
+FVector FGeoTransformer::transformByGeoRef(const FVector &GridPos) const {
+    return geoRef->TransformLongitudeLatitudeHeightPositionToUnreal(
+        {FMath::RadiansToDegrees(mins.X + GridPos.X * deltas.X),
+         FMath::RadiansToDegrees(mins.Y + GridPos.Y * deltas.Y), mins.Z + GridPos.Z * deltas.Z});
+}
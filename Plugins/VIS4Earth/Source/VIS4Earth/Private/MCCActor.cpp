@@ -1,12 +1,61 @@
 ﻿#include "MCCActor.h"
 
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#include "Algo/BinarySearch.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
 #include "Components/CheckBox.h"
 #include "Components/ComboBoxString.h"
 #include "Components/EditableText.h"
 #include "Components/NamedSlot.h"
+#include "Hash/xxhash.h"
 
+#include "GeoTransformer.h"
+#include "MCCDecimator.h"
+#include "MCCFlyingEdges.h"
+#include "MCCSurfaceNets.h"
 #include "MCCTable.h"
 
+namespace {
+
+// Normals on the grid, if any, are transformed instead of generated from triangles
+void TransformThenGenNormals(const FGeoTransformer &Transformer, TArray<FVector> &Positions,
+                             TArray<FVector> &Normals, TArray<int32> &Indices) {
+    if (!Normals.IsEmpty()) {
+        Transformer.TransformNormals(Positions, Normals);
+        Transformer.Transform(Positions);
+        for (int32 i = 0; i < Indices.Num(); i += 3)
+            // From CCW to CW
+            std::swap(Indices[i + 1], Indices[i + 2]);
+        return;
+    }
+
+    Transformer.Transform(Positions);
+
+    Normals.SetNumZeroed(Positions.Num(), false);
+    for (int32 i = 0; i < Indices.Num(); i += 3) {
+        auto e0 = Positions[Indices[i + 1]] - Positions[Indices[i]];
+        auto e1 = Positions[Indices[i + 2]] - Positions[Indices[i]];
+        auto norm = FVector::CrossProduct(e0, e1);
+        norm.Normalize();
+
+        for (int32 ii = 0; ii < 3; ++ii)
+            Normals[Indices[i + ii]] += norm;
+    }
+    for (auto &normal : Normals)
+        normal.Normalize();
+
+    for (int32 i = 0; i < Indices.Num(); i += 3)
+        // From CCW to CW
+        std::swap(Indices[i + 1], Indices[i + 2]);
+}
+
+} // namespace
+
 void AMCCActor::OnComboBoxString_MeshSmoothTypeSelectionChanged(FString SelectedItem,
                                                                 ESelectInfo::Type SelectionType) {
     auto enumClass = StaticEnum<EMCCMeshSmoothType>();
@@ -87,7 +136,7 @@ void AMCCActor::setupSignalsSlots() {
 }
 
 void AMCCActor::checkAndCorrectParameters() {
-    if (!VolumeComponent->VolumeTexture)
+    if (!VolumeComponent->HasVolume())
         return;
 
     {
@@ -99,9 +148,7 @@ void AMCCActor::checkAndCorrectParameters() {
             IsoValue = vxMax;
     }
 
-    FIntVector3 voxPerVol(VolumeComponent->VolumeTexture->GetSizeX(),
-                          VolumeComponent->VolumeTexture->GetSizeY(),
-                          VolumeComponent->VolumeTexture->GetSizeZ());
+    FIntVector3 voxPerVol = VolumeComponent->GetVoxelPerVolume();
     auto voxPerVolYxX = static_cast<size_t>(voxPerVol.Y) * voxPerVol.X;
     if (HeightRange[0] < 0)
         HeightRange[0] = 0;
@@ -116,229 +163,873 @@ void AMCCActor::checkAndCorrectParameters() {
 void AMCCActor::marchingCube() {
     checkAndCorrectParameters();
 
-    if (!VolumeComponent->VolumeTexture) {
+    // Supersedes extraction in flight, even if this one ends early
+    auto generation = ++*marchingCubeGeneration;
+
+    if (!VolumeComponent->HasVolume()) {
         emptyMesh();
         return;
     }
 
-    edges.clear();
-    auto gen = [&]<SupportedVoxelType T>(T) {
-        FIntVector3 voxPerVol(VolumeComponent->VolumeTexture->GetSizeX(),
-                              VolumeComponent->VolumeTexture->GetSizeY(),
-                              VolumeComponent->VolumeTexture->GetSizeZ());
-        auto [vxMin, vxMax, vxExt] =
-            VolumeData::GetVoxelMinMaxExtent(VolumeComponent->GetVolumeVoxelType());
-        auto lonExt = GeoComponent->LongtitudeRange[1] - GeoComponent->LongtitudeRange[0];
-        auto latExt = GeoComponent->LatitudeRange[1] - GeoComponent->LatitudeRange[0];
-        auto hExt = GeoComponent->HeightRange[1] - GeoComponent->HeightRange[0];
-
-        auto hashEdge = [](const FIntVector3 &edgeID) {
-            size_t hash = edgeID.X;
-            hash = (hash << 32) | edgeID.Y;
-            hash = (hash << 2) | edgeID.Z;
-            return std::hash<size_t>()(hash);
-        };
-        std::array<std::unordered_map<FIntVector3, FVertexID, decltype(hashEdge)>, 2> edge2vertIDs;
-
-        positions.Empty();
-        normals.Empty();
-        uvs.Empty();
-        indices.Empty();
-
-        edges.clear();
-        FIntVector3 startPos;
-        for (startPos.Z = HeightRange[0]; startPos.Z < HeightRange[1]; ++startPos.Z) {
-            if (startPos.Z != HeightRange[0]) {
-                edge2vertIDs[0] = std::move(edge2vertIDs[1]);
-                edge2vertIDs[1].clear(); // hash map only stores vertices of 2 consecutive heights
+    // Workers read a snapshot of parameters, which may change before they finish
+    TSharedPtr<FGeoTransformer> transformer;
+    {
+        auto ret = FGeoTransformer::Create({.LongtitudeRange = GeoComponent->LongtitudeRange,
+                                            .LatitudeRange = GeoComponent->LatitudeRange,
+                                            .HeightRange = GeoComponent->HeightRange,
+                                            .Dimension = VolumeComponent->GetVoxelPerVolume(),
+                                            .GeoRef = GeoComponent->GeoRef});
+        if (ret.IsType<FString>()) {
+            UE_LOG(LogStats, Error, TEXT("%s"), *ret.Get<FString>());
+            emptyMesh();
+            return;
+        }
+        transformer = ret.Get<TSharedRef<FGeoTransformer>>();
+    }
+    // Smoothing runs on the volume texture, which paged volumes do not have
+    auto useSmoothedVolume = UseSmoothedVolume && !VolumeComponent->IsVolumePaged() &&
+                             VolumeComponent->GetVolumeCPUDataSmoothed().IsValid();
+    auto volumeSampler = useSmoothedVolume ? VolumeComponent->CreateVolumeSamplerSmoothed()
+                                           : VolumeComponent->CreateVolumeSampler();
+    // Skips blocks not crossed by the isosurface. Without the tree, all cells are marched.
+    auto minMaxTree = useSmoothedVolume ? VolumeComponent->GetVolumeMinMaxTreeSmoothed()
+                                        : VolumeComponent->GetVolumeMinMaxTree();
+    FIntVector3 voxPerVol = VolumeComponent->GetVoxelPerVolume();
+    auto voxTy = VolumeComponent->GetVolumeVoxelType();
+    // Without the cache, gradients are sampled by workers
+    auto useGradientNormal = NormalType == EMCCNormalType::Gradient;
+    VolumeComponent->SetKeepVolumeGradient(useGradientNormal && CacheVolumeGradient);
+    TSharedPtr<const FVolumeGradient> volumeGradient;
+    if (useGradientNormal)
+        volumeGradient = useSmoothedVolume ? VolumeComponent->GetVolumeGradientSmoothed()
+                                           : VolumeComponent->GetVolumeGradient();
+
+    // Buffers replaced by the last commit are refilled, instead of growing new ones
+    TSharedRef<Mesh> mesh = spareMesh.IsValid() ? spareMesh.ToSharedRef() : MakeShared<Mesh>();
+    spareMesh.Reset();
+
+    // Stage 1 (worker thread): marching, decimation and transformation
+    Async(EAsyncExecution::ThreadPool, [weakThis = TWeakObjectPtr<AMCCActor>(this),
+                                        generationCounter = marchingCubeGeneration, generation,
+                                        transformer, volumeSampler, minMaxTree, voxPerVol, voxTy,
+                                        useGradientNormal, volumeGradient, mesh, backend = Backend,
+                                        useLerp = UseLerp, isoValue = IsoValue,
+                                        decimationRatio = DecimationRatio,
+                                        decimationMaxError = DecimationMaxError, lodNum = LODNum,
+                                        heightRange = HeightRange,
+                                        prevMarched = marchedBricks]() {
+        auto isSuperseded = [&]() { return generationCounter->load() != generation; };
+
+        // Cells of each brick of MeshBricks are marched into a chunk by one worker. Chunks of
+        // bricks whose voxels, cells in the height range and crossing by the isosurface did not
+        // change since the last committed extraction are taken from it instead. Chunks are then
+        // spliced into the mesh in the order of bricks, where vertices on edges shared by bricks
+        // are welded to those of the first brick.
+        static constexpr int32 BrickSize = MeshBricks::BrickSize;
+        auto gen = [&]<SupportedVoxelType T>(T) {
+            auto [vxMin, vxMax, vxExt] = VolumeData::GetVoxelMinMaxExtent(voxTy);
+            auto brickNum = MeshBricks::GetBrickNum(voxPerVol);
+            auto marched = MakeShared<MarchedBricks>();
+            marched->VoxelType = voxTy;
+            marched->Dimension = voxPerVol;
+            marched->UseLerp = useLerp;
+            marched->UseGradientNormal = useGradientNormal;
+            marched->IsoValue = isoValue;
+            marched->Volume = volumeSampler.GetVolume();
+            marched->BrickCache = volumeSampler.GetBrickCache();
+            marched->Chunks.SetNum(brickNum.X * brickNum.Y * brickNum.Z);
+
+            // Cells starting at voxels in [Min, Max), clipped to the height range
+            auto getBrickCellRange = [&](int32 BrickID) {
+                FIntVector3 min(BrickID % brickNum.X, BrickID / brickNum.X % brickNum.Y,
+                                BrickID / (brickNum.X * brickNum.Y));
+                min *= BrickSize;
+                FIntVector3 max(std::min(min.X + BrickSize, voxPerVol.X - 1),
+                                std::min(min.Y + BrickSize, voxPerVol.Y - 1),
+                                std::min(min.Z + BrickSize, heightRange[1]));
+                min.Z = std::max(min.Z, heightRange[0]);
+                return MakeTuple(min, max);
+            };
+            // Of corners of cells in [CellMin, CellMax), and voxels around them for gradients
+            auto hashVoxels = [&](const FIntVector3 &CellMin, const FIntVector3 &CellMax) {
+                auto *voxels = reinterpret_cast<const T *>(volumeSampler.GetVolume()->GetData());
+                FIntVector3 min, max;
+                for (int32 i = 0; i < 3; ++i) {
+                    min[i] = std::max(CellMin[i] - 1, 0);
+                    max[i] = std::min(CellMax[i] + 2, voxPerVol[i]);
+                }
+                FXxHash64Builder builder;
+                for (int32 z = min.Z; z < max.Z; ++z)
+                    for (int32 y = min.Y; y < max.Y; ++y)
+                        builder.Update(voxels + (static_cast<int64>(z) * voxPerVol.Y + y) *
+                                                    voxPerVol.X +
+                                           min.X,
+                                       sizeof(T) * (max.X - min.X));
+                return builder.Finalize().Hash;
+            };
+
+            // Dirty bricks are those in the height range without reusable chunks
+            auto canReuse = prevMarched.IsValid() && prevMarched->VoxelType == voxTy &&
+                            prevMarched->Dimension == voxPerVol &&
+                            prevMarched->UseLerp == useLerp &&
+                            prevMarched->UseGradientNormal == useGradientNormal;
+            auto isSameVolume = canReuse &&
+                                prevMarched->Volume.Pin() == volumeSampler.GetVolume() &&
+                                prevMarched->BrickCache.Pin() == volumeSampler.GetBrickCache();
+            TArray<TOptional<uint64>> voxelHashes;
+            voxelHashes.SetNum(marched->Chunks.Num());
+            ParallelFor(marched->Chunks.Num(), [&](int32 brickID) {
+                auto [min, max] = getBrickCellRange(brickID);
+                if (min.X >= max.X || min.Y >= max.Y || min.Z >= max.Z)
+                    return;
+
+                TSharedPtr<const BrickChunk> prevChunk;
+                if (canReuse)
+                    prevChunk = prevMarched->Chunks[brickID];
+                auto isSameRange = prevChunk.IsValid() && prevChunk->ZRange.X == min.Z &&
+                                   prevChunk->ZRange.Y == max.Z;
+                // Paged volumes are not hashed, which would page all their bricks in
+                if (isSameVolume && isSameRange)
+                    voxelHashes[brickID] = prevChunk->VoxelHash;
+                else if (volumeSampler.GetVolume().IsValid())
+                    voxelHashes[brickID] = hashVoxels(min, max);
+                if (!isSameRange)
+                    return;
+                if (!isSameVolume && (!voxelHashes[brickID].IsSet() ||
+                                      prevChunk->VoxelHash != voxelHashes[brickID]))
+                    return;
+
+                // Otherwise, a brick without triangles keeps none if it is not crossed now
+                auto isCrossed = [&]() {
+                    if (!minMaxTree.IsValid())
+                        return !prevChunk->VoxelRange.IsSet() ||
+                               FVolumeMinMaxTree::IsCrossed(*prevChunk->VoxelRange, isoValue);
+                    auto crossed = false;
+                    minMaxTree->ForEachActiveBlock(isoValue, min, max,
+                                                   [&](const FIntVector3 &) { crossed = true; });
+                    return crossed;
+                };
+                if (prevMarched->IsoValue == isoValue ||
+                    (prevChunk->Indices.IsEmpty() && !isCrossed()))
+                    marched->Chunks[brickID] = prevChunk;
+            });
+            TArray<int32> dirtyBrickIDs;
+            for (int32 brickID = 0; brickID < marched->Chunks.Num(); ++brickID) {
+                auto [min, max] = getBrickCellRange(brickID);
+                if (min.X < max.X && min.Y < max.Y && min.Z < max.Z &&
+                    !marched->Chunks[brickID].IsValid())
+                    dirtyBrickIDs.Emplace(brickID);
             }
 
-            for (startPos.Y = 0; startPos.Y < voxPerVol.Y - 1; ++startPos.Y)
-                for (startPos.X = 0; startPos.X < voxPerVol.X - 1; ++startPos.X) {
-                    // Voxels in CCW order form a grid
-                    // +-----------------+
-                    // |       3 <--- 2  |
-                    // |       |     /|\ |
-                    // |      \|/     |  |
-                    // |       0 ---> 1  |
-                    // |      /          |
-                    // |  7 <--- 6       |
-                    // |  | /   /|\      |
-                    // | \|/_    |       |
-                    // |  4 ---> 5       |
-                    // +-----------------+
-                    uint8 cornerState = 0;
+            // Voxels in CCW order form a grid
+            // +-----------------+
+            // |       3 <--- 2  |
+            // |       |     /|\ |
+            // |      \|/     |  |
+            // |       0 ---> 1  |
+            // |      /          |
+            // |  7 <--- 6       |
+            // |  | /   /|\      |
+            // | \|/_    |       |
+            // |  4 ---> 5       |
+            // +-----------------+
+            auto sampleCell = [&](FVolumeSampler &Sampler, FIntVector3 StartPos,
+                                  std::array<float, 8> &Scalars) {
+                uint8 cornerState = 0;
+                for (int32 i = 0; i < 8; ++i) {
+                    Scalars[i] = Sampler.Sample<T>(StartPos);
+                    if (Scalars[i] >= isoValue)
+                        cornerState |= 1 << i;
+
+                    StartPos.X += i == 0 || i == 4 ? 1 : i == 2 || i == 6 ? -1 : 0;
+                    StartPos.Y += i == 1 || i == 5 ? 1 : i == 3 || i == 7 ? -1 : 0;
+                    StartPos.Z += i == 3 ? 1 : i == 7 ? -1 : 0;
+                }
+                return cornerState;
+            };
+
+            // Vertex IDs of edges starting at voxels of a brick, indexed like edge IDs but
+            // relative to the corners of its cells. Kept per worker, allocated once and reset for
+            // each brick.
+            TArray<TArray<int32>> workerEdgeSlots;
+            TArray<TArray<int32> *> edgeSlotContexts;
+            auto getWorkerEdgeSlots = [&](int32 WorkerIdx, int32 WorkerNum) {
+                // Called on this thread before workers start, with the same WorkerNum
+                if (workerEdgeSlots.Num() < WorkerNum)
+                    workerEdgeSlots.SetNum(WorkerNum);
+                return &workerEdgeSlots[WorkerIdx];
+            };
+
+            // Edge indexed by Start Voxel Position
+            // +----------+
+            // | /*\  *|  |
+            // |  |  /    |
+            // | e1 e2    |
+            // |  * e0 *> |
+            // +----------+
+            // *:   startPos
+            // *>:  startPos + (1,0,0)
+            // /*\: startPos + (0,1,0)
+            // *|:  startPos + (0,0,1)
+            // Kind(e0) = 0, Kind(e1) = 1, Kind(e2) = 2
+            auto marchBrick = [&](TArray<int32> *WorkerEdgeSlots, int32 dirtyIdx) {
+                if (isSuperseded())
+                    return;
+
+                auto brickID = dirtyBrickIDs[dirtyIdx];
+                auto [min, max] = getBrickCellRange(brickID);
+                auto sampler = volumeSampler;
+                if (auto &cache = sampler.GetBrickCache(); cache.IsValid())
+                    cache->PrefetchBricks(min, max + FIntVector3(1, 1, 1));
+
+                auto chunk = MakeShared<BrickChunk>();
+                chunk->ZRange = {min.Z, max.Z};
+                chunk->VoxelHash = voxelHashes[brickID];
+
+                auto extent = max - min + FIntVector3(1, 1, 1);
+                auto &edgeSlots = *WorkerEdgeSlots;
+                edgeSlots.SetNumUninitialized(3 * extent.X * extent.Y * extent.Z, false);
+                // Every byte of INDEX_NONE is 0xff
+                FMemory::Memset(edgeSlots.GetData(), 0xff, sizeof(int32) * edgeSlots.Num());
+                auto getSlot = [&](const FIntVector3 &StartPos, uint8 EdgeIdx) {
+                    auto kind = EdgeIdx >= 8 ? 2
+                                : EdgeIdx == 1 || EdgeIdx == 3 || EdgeIdx == 5 || EdgeIdx == 7
+                                    ? 1
+                                    : 0;
+                    FIntVector3 pos(
+                        StartPos.X + (EdgeIdx == 1 || EdgeIdx == 5 || EdgeIdx == 9 ||
+                                      EdgeIdx == 10),
+                        StartPos.Y + (EdgeIdx == 2 || EdgeIdx == 6 || EdgeIdx == 10 ||
+                                      EdgeIdx == 11),
+                        StartPos.Z + (EdgeIdx >= 4 && EdgeIdx < 8));
+                    pos -= min;
+                    return ((kind * extent.Z + pos.Z) * extent.Y + pos.Y) * extent.X + pos.X;
+                };
+
+                // Pass 1: finding cells with triangles, and marking their edges
+                struct Cell {
+                    FIntVector3 Pos;
+                    uint8 CornerState;
+                };
+                TArray<Cell> cells;
+                int32 indexNum = 0;
+                FVector2f voxelRange(TNumericLimits<float>::Max(),
+                                     TNumericLimits<float>::Lowest());
+                auto marchCells = [&](const FIntVector3 &Min, const FIntVector3 &Max) {
+                    FIntVector3 startPos;
                     std::array<float, 8> scalars;
-                    for (int32 i = 0; i < 8; ++i) {
-                        if (UseSmoothedVolume) {
-                            scalars[i] = VolumeComponent->SampleVolumeCPUDataSmoothed(startPos);
-                            scalars[i] = scalars[i] * vxExt + vxMin; // [0, 1] -> [vxMin, vxMax]
-                        } else
-                            scalars[i] = VolumeComponent->SampleVolumeCPUData<T>(startPos);
-                        if (scalars[i] >= IsoValue)
-                            cornerState |= 1 << i;
-
-                        startPos.X += i == 0 || i == 4 ? 1 : i == 2 || i == 6 ? -1 : 0;
-                        startPos.Y += i == 1 || i == 5 ? 1 : i == 3 || i == 7 ? -1 : 0;
-                        startPos.Z += i == 3 ? 1 : i == 7 ? -1 : 0;
+                    for (startPos.Z = Min.Z; startPos.Z < Max.Z; ++startPos.Z)
+                        for (startPos.Y = Min.Y; startPos.Y < Max.Y; ++startPos.Y)
+                            for (startPos.X = Min.X; startPos.X < Max.X; ++startPos.X) {
+                                auto cornerState = sampleCell(sampler, startPos, scalars);
+                                for (auto scalar : scalars) {
+                                    voxelRange.X = std::min(voxelRange.X, scalar);
+                                    voxelRange.Y = std::max(voxelRange.Y, scalar);
+                                }
+                                if (GVertNumTable[cornerState] == 0)
+                                    continue;
+
+                                cells.Add({startPos, cornerState});
+                                indexNum += static_cast<int32>(GVertNumTable[cornerState]);
+                                for (uint32 i = 0; i < GVertNumTable[cornerState]; ++i)
+                                    edgeSlots[getSlot(startPos, GEdgeTable[cornerState][i])] = 0;
+                            }
+                };
+                if (!minMaxTree.IsValid()) {
+                    marchCells(min, max);
+                    // All cells are sampled only without the tree
+                    chunk->VoxelRange = voxelRange;
+                } else {
+                    static constexpr int32 BlockSize = FVolumeMinMaxTree::BlockSize;
+                    TArray<FIntVector3> activeBlocks;
+                    minMaxTree->ForEachActiveBlock(
+                        isoValue, min, max,
+                        [&](const FIntVector3 &BlockCoord) { activeBlocks.Emplace(BlockCoord); });
+                    activeBlocks.Sort([](const FIntVector3 &A, const FIntVector3 &B) {
+                        return A.Z < B.Z ||
+                               (A.Z == B.Z && (A.Y < B.Y || (A.Y == B.Y && A.X < B.X)));
+                    });
+                    for (auto &block : activeBlocks) {
+                        FIntVector3 blockMin, blockMax;
+                        for (int32 i = 0; i < 3; ++i) {
+                            blockMin[i] = std::max(block[i] * BlockSize, min[i]);
+                            blockMax[i] = std::min((block[i] + 1) * BlockSize, max[i]);
+                        }
+                        marchCells(blockMin, blockMax);
                     }
-                    std::array omegas = {scalars[0] / (scalars[1] + scalars[0]),
-                                         scalars[1] / (scalars[2] + scalars[1]),
-                                         scalars[3] / (scalars[3] + scalars[2]),
-                                         scalars[0] / (scalars[0] + scalars[3]),
-                                         scalars[4] / (scalars[5] + scalars[4]),
-                                         scalars[5] / (scalars[6] + scalars[5]),
-                                         scalars[7] / (scalars[7] + scalars[6]),
-                                         scalars[4] / (scalars[4] + scalars[7]),
-                                         scalars[0] / (scalars[0] + scalars[4]),
-                                         scalars[1] / (scalars[1] + scalars[5]),
-                                         scalars[2] / (scalars[2] + scalars[6]),
-                                         scalars[3] / (scalars[3] + scalars[7])};
-
-                    // Edge indexed by Start Voxel Position
-                    // +----------+
-                    // | /*\  *|  |
-                    // |  |  /    |
-                    // | e1 e2    |
-                    // |  * e0 *> |
-                    // +----------+
-                    // *:   startPos
-                    // *>:  startPos + (1,0,0)
-                    // /*\: startPos + (0,1,0)
-                    // *|:  startPos + (0,0,1)
-                    // ID(e0) = (startPos.xy, 00)
-                    // ID(e1) = (startPos.xy, 01)
-                    // ID(e2) = (startPos.xy, 10)
-                    for (uint32 i = 0; i < GVertNumTable[cornerState]; i += 3) {
-                        for (int32 ii = 0; ii < 3; ++ii) {
-                            auto ei = GEdgeTable[cornerState][i + ii];
-                            FIntVector3 edgeID(
-                                startPos.X + (ei == 1 || ei == 5 || ei == 9 || ei == 10 ? 1 : 0),
-                                startPos.Y + (ei == 2 || ei == 6 || ei == 10 || ei == 11 ? 1 : 0),
-                                ei >= 8                                    ? 2
-                                : ei == 1 || ei == 3 || ei == 5 || ei == 7 ? 1
-                                                                           : 0);
-                            auto edge2vertIDIdx = ei >= 4 && ei < 8 ? 1 : 0;
-                            if (auto itr = edge2vertIDs[edge2vertIDIdx].find(edgeID);
-                                itr != edge2vertIDs[edge2vertIDIdx].end()) {
-                                indices.Emplace(itr->second);
-                                continue;
+                }
+
+                // Pass 2: numbering vertices of marked edges in the order of slots, which is the
+                // ascending order of their edge IDs, and placing them on the edges
+                int32 vertNum = 0;
+                for (auto &slot : edgeSlots)
+                    if (slot != INDEX_NONE)
+                        slot = vertNum++;
+                chunk->Positions.SetNumUninitialized(vertNum);
+                chunk->Normals.SetNumUninitialized(useGradientNormal ? vertNum : 0);
+                chunk->UVs.SetNumUninitialized(vertNum);
+                chunk->EdgeIDs.SetNumUninitialized(vertNum);
+                auto getGradient = [&](const FIntVector3 &Pos) {
+                    return volumeGradient.IsValid()
+                               ? volumeGradient->Get(Pos)
+                               : FVolumeGradient::Sample<T>(sampler, Pos, voxPerVol);
+                };
+                int32 slotIdx = 0;
+                for (int32 kind = 0; kind < 3; ++kind) {
+                    FIntVector3 pos;
+                    for (pos.Z = min.Z; pos.Z < min.Z + extent.Z; ++pos.Z)
+                        for (pos.Y = min.Y; pos.Y < min.Y + extent.Y; ++pos.Y)
+                            for (pos.X = min.X; pos.X < min.X + extent.X; ++pos.X, ++slotIdx) {
+                                auto vertID = edgeSlots[slotIdx];
+                                if (vertID == INDEX_NONE)
+                                    continue;
+
+                                // From the first to the second voxel of the edge
+                                auto nextPos = pos;
+                                ++nextPos[kind];
+                                float scalars[2] = {static_cast<float>(sampler.Sample<T>(pos)),
+                                                    static_cast<float>(sampler.Sample<T>(nextPos))};
+                                auto omega = scalars[0] / (scalars[1] + scalars[0]);
+                                auto t = useLerp ? omega : .5f;
+
+                                FVector position(pos);
+                                position[kind] += t;
+                                chunk->Positions[vertID] = position;
+                                // [vxMin, vxMax] -> [0, 1]
+                                chunk->UVs[vertID] = FVector2D(
+                                    (omega * scalars[0] + (1.f - omega) * scalars[1] - vxMin) /
+                                        vxExt,
+                                    0.f);
+                                if (useGradientNormal)
+                                    chunk->Normals[vertID] = FVector(
+                                        FMath::Lerp(getGradient(pos), getGradient(nextPos), t));
+                                chunk->EdgeIDs[vertID] =
+                                    ((static_cast<int64>(kind) * voxPerVol.Z + pos.Z) *
+                                         voxPerVol.Y +
+                                     pos.Y) *
+                                        voxPerVol.X +
+                                    pos.X;
                             }
+                }
 
-                            FVector pos(
-                                startPos.X + (ei == 0 || ei == 2 || ei == 4 || ei == 6
-                                                  ? (UseLerp ? omegas[ei] : .5f)
-                                              : ei == 1 || ei == 5 || ei == 9 || ei == 10 ? 1.f
-                                                                                          : 0.f),
-                                startPos.Y + (ei == 1 || ei == 3 || ei == 5 || ei == 7
-                                                  ? (UseLerp ? omegas[ei] : .5f)
-                                              : ei == 2 || ei == 6 || ei == 10 || ei == 11 ? 1.f
-                                                                                           : 0.f),
-                                startPos.Z + (ei >= 8   ? (UseLerp ? omegas[ei] : .5f)
-                                              : ei >= 4 ? 1.f
-                                                        : 0.f));
-                            pos /= FVector(voxPerVol);
-                            pos = [&]() {
-                                auto lon = GeoComponent->LongtitudeRange[0] + pos.X * lonExt;
-                                auto lat = GeoComponent->LatitudeRange[0] + pos.Y * latExt;
-                                auto h = GeoComponent->HeightRange[0] + pos.Z * hExt;
-
-                                return GeoComponent->GeoRef
-                                    ->TransformLongitudeLatitudeHeightPositionToUnreal(
-                                        {lon, lat, h});
-                            }();
-
-                            auto scalar = [&]() {
-                                switch (ei) {
-                                case 0:
-                                    return omegas[0] * scalars[0] + (1.f - omegas[0]) * scalars[1];
-                                case 1:
-                                    return omegas[1] * scalars[1] + (1.f - omegas[1]) * scalars[2];
-                                case 2:
-                                    return omegas[2] * scalars[3] + (1.f - omegas[2]) * scalars[2];
-                                case 3:
-                                    return omegas[3] * scalars[0] + (1.f - omegas[3]) * scalars[3];
-                                case 4:
-                                    return omegas[4] * scalars[4] + (1.f - omegas[4]) * scalars[5];
-                                case 5:
-                                    return omegas[5] * scalars[5] + (1.f - omegas[5]) * scalars[6];
-                                case 6:
-                                    return omegas[6] * scalars[7] + (1.f - omegas[6]) * scalars[6];
-                                case 7:
-                                    return omegas[7] * scalars[4] + (1.f - omegas[7]) * scalars[7];
-                                default:
-                                    return omegas[ei] * scalars[ei - 8] +
-                                           (1.f - omegas[ei]) * scalars[ei - 4];
-                                }
-                            }();
-                            scalar = (scalar - vxMin) / vxExt; // [vxMin, vxMax] -> [0, 1]
-
-                            auto id = positions.Emplace(pos);
-                            normals.Emplace(FVector::Zero());
-                            uvs.Emplace(scalar, 0.f);
-                            indices.Emplace(id);
-                            edge2vertIDs[edge2vertIDIdx].emplace(edgeID, indices.Last());
-                        }
+                // Pass 3: writing triangles of cells
+                chunk->Indices.SetNumUninitialized(indexNum);
+                int32 indexID = 0;
+                for (auto &cell : cells)
+                    for (uint32 i = 0; i < GVertNumTable[cell.CornerState]; ++i)
+                        chunk->Indices[indexID++] =
+                            edgeSlots[getSlot(cell.Pos, GEdgeTable[cell.CornerState][i])];
+
+                marched->Chunks[brickID] = chunk;
+            };
+            ParallelForWithTaskContext(TEXT("MCC Marching"), edgeSlotContexts,
+                                       dirtyBrickIDs.Num(), 1, getWorkerEdgeSlots, marchBrick);
+            if (isSuperseded())
+                return;
+
+            // Chunks with triangles in the order of bricks, and where their ranges start
+            struct Splice {
+                int32 BrickID;
+                int32 VertOffset = 0;
+                int32 IndexOffset = 0;
+                // Of vertices among the ones owned by the chunk, or INDEX_NONE for those welded
+                // to vertices of earlier chunks
+                TArray<int32> OwnedRanks;
+                int32 OwnedNum = 0;
+                // Of vertices welded to vertex Get<2>() of the chunk of brick Get<1>()
+                TArray<TTuple<int32, int32, int32>> Welds;
+            };
+            TArray<Splice> splices;
+            TArray<int32> spliceIndices;
+            spliceIndices.Init(INDEX_NONE, marched->Chunks.Num());
+            for (int32 brickID = 0; brickID < marched->Chunks.Num(); ++brickID)
+                if (auto &chunk = marched->Chunks[brickID];
+                    chunk.IsValid() && !chunk->Indices.IsEmpty()) {
+                    spliceIndices[brickID] = splices.Num();
+                    splices.Emplace_GetRef().BrickID = brickID;
+                }
 
-                        std::array<FVertexID, 3> triVertIDs = {indices[indices.Num() - 3],
-                                                               indices[indices.Num() - 2],
-                                                               indices[indices.Num() - 1]};
-                        auto norm = [&]() {
-                            auto e0 = positions[triVertIDs[1]] - positions[triVertIDs[0]];
-                            auto e1 = positions[triVertIDs[2]] - positions[triVertIDs[0]];
-                            auto norm = FVector::CrossProduct(e0, e1);
-                            norm.Normalize();
-
-                            return norm;
-                        }();
-                        normals[triVertIDs[0]] += norm;
-                        normals[triVertIDs[1]] += norm;
-                        normals[triVertIDs[2]] += norm;
-
-                        edges.emplace(triVertIDs[0], triVertIDs[1]);
-                        edges.emplace(triVertIDs[1], triVertIDs[0]);
-                        edges.emplace(triVertIDs[1], triVertIDs[2]);
-                        edges.emplace(triVertIDs[2], triVertIDs[1]);
-                        edges.emplace(triVertIDs[2], triVertIDs[0]);
-                        edges.emplace(triVertIDs[0], triVertIDs[2]);
+            // A vertex is owned by the first brick having it, among those of cells around its edge
+            ParallelFor(splices.Num(), [&](int32 spliceIdx) {
+                auto &splice = splices[spliceIdx];
+                auto &chunk = *marched->Chunks[splice.BrickID];
+                splice.OwnedRanks.SetNumUninitialized(chunk.EdgeIDs.Num());
+                for (int32 vertID = 0; vertID < chunk.EdgeIDs.Num(); ++vertID) {
+                    auto edgeID = chunk.EdgeIDs[vertID];
+                    auto kind =
+                        static_cast<int32>(edgeID / voxPerVol.X / voxPerVol.Y / voxPerVol.Z);
+                    FIntVector3 pos(static_cast<int32>(edgeID % voxPerVol.X),
+                                    static_cast<int32>(edgeID / voxPerVol.X % voxPerVol.Y),
+                                    static_cast<int32>(edgeID / voxPerVol.X / voxPerVol.Y %
+                                                       voxPerVol.Z));
+
+                    auto ownerBrickID = splice.BrickID;
+                    auto ownerVertID = vertID;
+                    for (int32 i = 0; i < 4; ++i) {
+                        // Cells around the edge start at its voxel minus 0 or 1 along the other
+                        // 2 axes
+                        auto cell = pos;
+                        cell[(kind + 1) % 3] -= i & 0b01;
+                        cell[(kind + 2) % 3] -= (i >> 1) & 0b01;
+                        if (cell.X < 0 || cell.Y < 0 || cell.Z < 0 || cell.X >= voxPerVol.X - 1 ||
+                            cell.Y >= voxPerVol.Y - 1 || cell.Z >= voxPerVol.Z - 1)
+                            continue;
+
+                        auto brick = cell / BrickSize;
+                        auto brickID = (brick.Z * brickNum.Y + brick.Y) * brickNum.X + brick.X;
+                        if (brickID >= ownerBrickID || spliceIndices[brickID] == INDEX_NONE)
+                            continue;
+                        if (auto idx = Algo::BinarySearch(marched->Chunks[brickID]->EdgeIDs,
+                                                           edgeID);
+                            idx != INDEX_NONE) {
+                            ownerBrickID = brickID;
+                            ownerVertID = idx;
+                        }
+                    }
+                    if (ownerBrickID == splice.BrickID)
+                        splice.OwnedRanks[vertID] = splice.OwnedNum++;
+                    else {
+                        splice.OwnedRanks[vertID] = INDEX_NONE;
+                        splice.Welds.Emplace(vertID, ownerBrickID, ownerVertID);
                     }
                 }
+            });
+
+            // Capacity of the mesh is kept for the next extraction
+            int32 vertNum = 0;
+            int32 indexNum = 0;
+            for (auto &splice : splices) {
+                splice.VertOffset = vertNum;
+                splice.IndexOffset = indexNum;
+                vertNum += splice.OwnedNum;
+                indexNum += marched->Chunks[splice.BrickID]->Indices.Num();
+            }
+            mesh->Positions.SetNumUninitialized(vertNum, false);
+            mesh->Normals.SetNumUninitialized(useGradientNormal ? vertNum : 0, false);
+            mesh->UVs.SetNumUninitialized(vertNum, false);
+            mesh->Indices.SetNumUninitialized(indexNum, false);
+
+            ParallelFor(splices.Num(), [&](int32 spliceIdx) {
+                auto &splice = splices[spliceIdx];
+                auto &chunk = *marched->Chunks[splice.BrickID];
+                TArray<int32> vertIDs;
+                vertIDs.SetNumUninitialized(chunk.EdgeIDs.Num());
+                for (int32 vertID = 0; vertID < vertIDs.Num(); ++vertID) {
+                    auto rank = splice.OwnedRanks[vertID];
+                    if (rank == INDEX_NONE)
+                        continue;
+
+                    auto dst = splice.VertOffset + rank;
+                    vertIDs[vertID] = dst;
+                    mesh->Positions[dst] = chunk.Positions[vertID];
+                    if (useGradientNormal)
+                        mesh->Normals[dst] = chunk.Normals[vertID];
+                    mesh->UVs[dst] = chunk.UVs[vertID];
+                }
+                for (auto &[vertID, ownerBrickID, ownerVertID] : splice.Welds) {
+                    auto &owner = splices[spliceIndices[ownerBrickID]];
+                    vertIDs[vertID] = owner.VertOffset + owner.OwnedRanks[ownerVertID];
+                }
+
+                for (int32 i = 0; i < chunk.Indices.Num(); ++i)
+                    mesh->Indices[splice.IndexOffset + i] = vertIDs[chunk.Indices[i]];
+            });
+            mesh->Marched = marched;
+        };
+        // Of FMCCFlyingEdges and FMCCSurfaceNets, which share parameters and outputs
+        auto execBackend = [&]<typename BackendType, SupportedVoxelType T>(
+                               std::type_identity<BackendType>, T) {
+            auto [vxMin, vxMax, vxExt] = VolumeData::GetVoxelMinMaxExtent(voxTy);
+            typename BackendType::Output output;
+            output.Positions = MoveTemp(mesh->Positions);
+            output.Normals = MoveTemp(mesh->Normals);
+            output.UVs = MoveTemp(mesh->UVs);
+            output.Indices = MoveTemp(mesh->Indices);
+            if (!BackendType::template Exec<T>({.Dimension = voxPerVol,
+                                                .HeightRange = heightRange,
+                                                .IsoValue = isoValue,
+                                                .UseLerp = useLerp,
+                                                .VoxelMin = vxMin,
+                                                .VoxelExtent = vxExt,
+                                                .GenGradientNormals = useGradientNormal,
+                                                .Gradient = volumeGradient.Get(),
+                                                .IsCancelled = isSuperseded},
+                                               volumeSampler, output))
+                return;
+
+            mesh->Positions = MoveTemp(output.Positions);
+            mesh->Normals = MoveTemp(output.Normals);
+            mesh->UVs = MoveTemp(output.UVs);
+            mesh->Indices = MoveTemp(output.Indices);
+        };
+
+        auto dispatch = [&]<SupportedVoxelType T>(T) {
+            if (backend == EMCCBackend::FlyingEdges)
+                execBackend(std::type_identity<FMCCFlyingEdges>(), T(0));
+            else if (backend == EMCCBackend::SurfaceNets)
+                execBackend(std::type_identity<FMCCSurfaceNets>(), T(0));
+            else
+                gen(T(0));
+        };
+
+        // The last committed mesh is left in the spare buffers, which must not be taken as the
+        // result when nothing is marched
+        mesh->Positions.SetNum(0, false);
+        mesh->Normals.SetNum(0, false);
+        mesh->UVs.SetNum(0, false);
+        mesh->Indices.SetNum(0, false);
+        switch (voxTy) {
+        case ESupportedVoxelType::UInt8:
+            dispatch(uint8(0));
+            break;
+        case ESupportedVoxelType::UInt16:
+            dispatch(uint16(0));
+            break;
+        case ESupportedVoxelType::Float32:
+            dispatch(float(0));
+            break;
         }
+        if (isSuperseded())
+            return;
+        // Voxels of bricks failing to load read as 0, which must not make up the mesh
+        if (auto errMsg = volumeSampler.GetLoadError(); errMsg.IsSet()) {
+            AsyncTask(ENamedThreads::GameThread, [weakThis, generation, errMsg]() {
+                if (!weakThis.IsValid() || weakThis->marchingCubeGeneration->load() != generation)
+                    return;
 
-        for (auto &normal : normals)
-            normal.Normalize();
-        for (int32 i = 0; i < indices.Num(); i += 3)
-            // From CCW to CW
-            std::swap(indices[i + 1], indices[i + 2]);
-    };
+                UE_LOG(LogStats, Error, TEXT("%s"), **errMsg);
+                weakThis->emptyMesh();
+            });
+            return;
+        }
 
-    switch (VolumeComponent->GetVolumeVoxelType()) {
-    case ESupportedVoxelType::UInt8:
-        gen(uint8(0));
-        break;
-    }
+        // On the grid, in parallel over bricks, whose seams are kept
+        auto decimate = [&](LODMesh &LOD, float Ratio, float MaxError) {
+            if (!FMCCDecimator::Exec({.TargetRatio = Ratio,
+                                      .MaxError = MaxError,
+                                      .ClusterTriOffsets = LOD.Bricks.TriOffsets,
+                                      .ClusterVertOffsets = LOD.Bricks.VertOffsets,
+                                      .ClusterVertIDs = LOD.Bricks.VertIDs,
+                                      .IsCancelled = isSuperseded},
+                                     LOD.Positions, LOD.Normals, LOD.UVs, LOD.Indices))
+                return;
+            LOD.Bricks.Build(LOD.Indices, LOD.Positions, voxPerVol);
+        };
+        mesh->Bricks.Build(mesh->Indices, mesh->Positions, voxPerVol);
+        if (decimationRatio < 1.f)
+            decimate(*mesh, decimationRatio, decimationMaxError);
+        // Each coarser LOD is decimated from the previous one, without bounding errors
+        static constexpr float CoarseLODRatio = .25f;
+        mesh->CoarseLODs.SetNum(lodNum - 1);
+        for (int32 lod = 1; lod < lodNum && !isSuperseded(); ++lod) {
+            auto &coarseLOD = mesh->CoarseLODs[lod - 1];
+            coarseLOD =
+                lod == 1 ? static_cast<const LODMesh &>(*mesh) : mesh->CoarseLODs[lod - 2];
+            decimate(coarseLOD, CoarseLODRatio, 0.f);
+        }
+        if (isSuperseded())
+            return;
+
+        mesh->Adjacency.Build(mesh->Indices, mesh->Positions.Num());
+        // Off WGS84, transformation reads the georeference and is left to the game thread, where
+        // FGeoTransformer runs serially. On WGS84, it runs here in parallel without reading it.
+        auto transform = [transformer, mesh]() {
+            TransformThenGenNormals(*transformer, mesh->Positions, mesh->Normals, mesh->Indices);
+            for (auto &coarseLOD : mesh->CoarseLODs)
+                TransformThenGenNormals(*transformer, coarseLOD.Positions, coarseLOD.Normals,
+                                        coarseLOD.Indices);
+        };
+        if (transformer->IsOnWGS84() && !isSuperseded())
+            transform();
+
+        // Stage 2 (game thread): committing the mesh if it is still the latest
+        AsyncTask(ENamedThreads::GameThread,
+                  [weakThis, generation, transformer, mesh, transform]() {
+                      if (!weakThis.IsValid() ||
+                          weakThis->marchingCubeGeneration->load() != generation)
+                          return;
+
+                      if (!transformer->IsOnWGS84())
+                          transform();
+                      weakThis->commitMesh(mesh);
+                  });
+    });
+}
+
+void AMCCActor::commitMesh(const TSharedRef<Mesh> &MeshToCommit) {
+    Swap(positions, MeshToCommit->Positions);
+    Swap(normals, MeshToCommit->Normals);
+    Swap(uvs, MeshToCommit->UVs);
+    Swap(indices, MeshToCommit->Indices);
+    Swap(adjacency, MeshToCommit->Adjacency);
+    Swap(bricks, MeshToCommit->Bricks);
+    marchedBricks = MoveTemp(MeshToCommit->Marched);
+    auto coarseLODs = MoveTemp(MeshToCommit->CoarseLODs);
+    spareMesh = MeshToCommit;
     if (indices.IsEmpty()) {
         emptyMesh();
         return;
     }
 
-    MeshComponent->CreateMeshSection(static_cast<int>(EMeshSectionIndex::Normal), positions,
-                                     indices, normals, uvs, TArray<FColor>(),
-                                     TArray<FProcMeshTangent>(), false);
+    // Bricks without triangles any more, or of LODs not any more
+    auto lodNum = coarseLODs.Num() + 1;
+    for (auto itr = brickComponents.CreateIterator(); itr; ++itr) {
+        auto lod = itr->Key.X;
+        if (lod < lodNum &&
+            Algo::BinarySearch(lod == 0 ? bricks.BrickIDs : coarseLODs[lod - 1].Bricks.BrickIDs,
+                               itr->Key.Y) != INDEX_NONE)
+            continue;
+        itr->Value->DestroyComponent();
+        brickSectionHashes.Remove(itr->Key);
+        itr.RemoveCurrent();
+    }
+
+    uploadBrickSections(0, EMeshSectionIndex::Normal, bricks, positions, normals, uvs, indices);
+    for (int32 lod = 1; lod < lodNum; ++lod) {
+        auto &coarseLOD = coarseLODs[lod - 1];
+        uploadBrickSections(lod, EMeshSectionIndex::Normal, coarseLOD.Bricks, coarseLOD.Positions,
+                            coarseLOD.Normals, coarseLOD.UVs, coarseLOD.Indices);
+    }
+
+    // LOD L is drawn from LODDistance * 2^(L - 1) to LODDistance * 2^L, where 0 is unbounded
+    for (auto &[key, component] : brickComponents) {
+        auto minDrawDist = key.X == 0 ? 0.f : LODDistance * (1 << (key.X - 1));
+        if (component->MinDrawDistance != minDrawDist) {
+            component->MinDrawDistance = minDrawDist;
+            component->MarkRenderStateDirty();
+        }
+        component->SetCullDistance(key.X + 1 == lodNum ? 0.f : LODDistance * (1 << key.X));
+    }
+
+    generateSmoothedMeshThenUpdateMesh(true);
+}
+
+void AMCCActor::MeshBricks::Build(TArray<int32> &Indices, const TArray<FVector> &GridPositions,
+                                  const FIntVector3 &VoxelPerVolume) {
+    static constexpr int32 TriBatchSize = 4096;
+    auto brickPerVol = GetBrickNum(VoxelPerVolume);
+
+    // A triangle lies in the cell, and thus in the brick, of its centroid
+    auto triNum = Indices.Num() / 3;
+    TArray<int32> triBrickIDs;
+    triBrickIDs.SetNumUninitialized(triNum);
+    ParallelFor(FMath::DivideAndRoundUp(triNum, TriBatchSize), [&](int32 batchIdx) {
+        auto end = std::min((batchIdx + 1) * TriBatchSize, triNum);
+        for (int32 triID = batchIdx * TriBatchSize; triID < end; ++triID) {
+            auto centroid = (GridPositions[Indices[triID * 3]] +
+                             GridPositions[Indices[triID * 3 + 1]] +
+                             GridPositions[Indices[triID * 3 + 2]]) /
+                            3.;
+            FIntVector3 brickCoord;
+            for (int32 i = 0; i < 3; ++i)
+                brickCoord[i] = FMath::Clamp(FMath::FloorToInt32(centroid[i] / BrickSize), 0,
+                                             brickPerVol[i] - 1);
+            triBrickIDs[triID] =
+                (brickCoord.Z * brickPerVol.Y + brickCoord.Y) * brickPerVol.X + brickCoord.X;
+        }
+    });
+
+    // Counting sort keeps the order of triangles in a brick
+    TArray<int32> cursors;
+    cursors.Init(0, brickPerVol.X * brickPerVol.Y * brickPerVol.Z);
+    for (auto brickID : triBrickIDs)
+        ++cursors[brickID];
+    BrickIDs.Reset();
+    TriOffsets.Reset();
+    int32 triSum = 0;
+    for (int32 brickID = 0; brickID < cursors.Num(); ++brickID) {
+        if (cursors[brickID] == 0)
+            continue;
+        BrickIDs.Emplace(brickID);
+        TriOffsets.Emplace(triSum);
+        triSum += std::exchange(cursors[brickID], triSum);
+    }
+    TriOffsets.Emplace(triSum);
+
+    TArray<int32> sortedIndices;
+    sortedIndices.SetNumUninitialized(Indices.Num());
+    for (int32 triID = 0; triID < triNum; ++triID) {
+        auto dst = cursors[triBrickIDs[triID]]++ * 3;
+        for (int32 i = 0; i < 3; ++i)
+            sortedIndices[dst + i] = Indices[triID * 3 + i];
+    }
+    FMemory::Memcpy(Indices.GetData(), sortedIndices.GetData(), sizeof(int32) * Indices.Num());
+
+    TArray<TArray<int32>> brickVertIDs;
+    brickVertIDs.SetNum(BrickIDs.Num());
+    ParallelFor(BrickIDs.Num(), [&](int32 brickIdx) {
+        auto &vertIDs = brickVertIDs[brickIdx];
+        vertIDs.Append(Indices.GetData() + TriOffsets[brickIdx] * 3,
+                       (TriOffsets[brickIdx + 1] - TriOffsets[brickIdx]) * 3);
+        vertIDs.Sort();
+        vertIDs.SetNum(std::unique(vertIDs.GetData(), vertIDs.GetData() + vertIDs.Num()) -
+                       vertIDs.GetData());
+    });
+    VertOffsets.SetNumUninitialized(BrickIDs.Num() + 1);
+    VertOffsets[0] = 0;
+    for (int32 brickIdx = 0; brickIdx < BrickIDs.Num(); ++brickIdx)
+        VertOffsets[brickIdx + 1] = VertOffsets[brickIdx] + brickVertIDs[brickIdx].Num();
+    VertIDs.SetNumUninitialized(VertOffsets.Last());
+    ParallelFor(BrickIDs.Num(), [&](int32 brickIdx) {
+        FMemory::Memcpy(VertIDs.GetData() + VertOffsets[brickIdx],
+                        brickVertIDs[brickIdx].GetData(),
+                        sizeof(int32) * brickVertIDs[brickIdx].Num());
+    });
+}
+
+void AMCCActor::VertexAdjacency::Build(const TArray<int32> &Indices, int32 VertNum) {
+    static constexpr int32 TriBatchSize = 4096;
+    auto triBatchNum = FMath::DivideAndRoundUp(Indices.Num() / 3, TriBatchSize);
+    auto forEachTriangle = [&](auto &&Func) {
+        ParallelFor(triBatchNum, [&](int32 batchIdx) {
+            auto end = std::min((batchIdx + 1) * TriBatchSize * 3, Indices.Num());
+            for (int32 i = batchIdx * TriBatchSize * 3; i < end; i += 3)
+                Func(i);
+        });
+    };
+    auto exclusiveScan = [&](TArray<int32> &Counts) {
+        int32 sum = 0;
+        for (auto &count : Counts) {
+            auto prevSum = sum;
+            sum += count;
+            count = prevSum;
+        }
+    };
+
+    // A triangle adds the other 2 of its vertices to each of its vertices, where an edge shared
+    // by 2 triangles adds its vertices twice
+    TArray<int32> cursors;
+    cursors.Init(0, VertNum + 1);
+    forEachTriangle([&](int32 i) {
+        for (int32 ii = 0; ii < 3; ++ii)
+            FPlatformAtomics::InterlockedAdd(&cursors[Indices[i + ii]], 2);
+    });
+    exclusiveScan(cursors);
+    auto dupOffsets = cursors;
+
+    // Each triangle of a vertex takes half of its 2 slots
+    TriOffsets.SetNumUninitialized(VertNum + 1);
+    for (int32 vertID = 0; vertID <= VertNum; ++vertID)
+        TriOffsets[vertID] = dupOffsets[vertID] / 2;
+
+    TArray<int32> dupVertIDs;
+    dupVertIDs.SetNumUninitialized(cursors.Last());
+    TriIDs.SetNumUninitialized(TriOffsets.Last());
+    forEachTriangle([&](int32 i) {
+        for (int32 ii = 0; ii < 3; ++ii) {
+            auto slot = FPlatformAtomics::InterlockedAdd(&cursors[Indices[i + ii]], 2);
+            dupVertIDs[slot] = Indices[i + (ii + 1) % 3];
+            dupVertIDs[slot + 1] = Indices[i + (ii + 2) % 3];
+            TriIDs[slot / 2] = i / 3;
+        }
+    });
+
+    // Sorting makes rows independent of the order of scattering
+    Offsets.Init(0, VertNum + 1);
+    ParallelFor(VertNum, [&](int32 vertID) {
+        std::sort(TriIDs.GetData() + TriOffsets[vertID], TriIDs.GetData() + TriOffsets[vertID + 1]);
 
-    generateSmoothedMeshThenUpdateMesh();
+        auto *first = dupVertIDs.GetData() + dupOffsets[vertID];
+        auto *last = dupVertIDs.GetData() + dupOffsets[vertID + 1];
+        std::sort(first, last);
+        Offsets[vertID] = std::unique(first, last) - first;
+    });
+    exclusiveScan(Offsets);
+
+    VertIDs.SetNumUninitialized(Offsets.Last());
+    ParallelFor(VertNum, [&](int32 vertID) {
+        FMemory::Memcpy(VertIDs.GetData() + Offsets[vertID],
+                        dupVertIDs.GetData() + dupOffsets[vertID],
+                        sizeof(int32) * (Offsets[vertID + 1] - Offsets[vertID]));
+    });
+}
+
+void AMCCActor::emptyMesh() {
+    for (auto &[key, component] : brickComponents)
+        component->DestroyComponent();
+    brickComponents.Empty();
+    brickSectionHashes.Empty();
 }
 
-void AMCCActor::emptyMesh() { MeshComponent->ClearAllMeshSections(); }
+void AMCCActor::uploadBrickSections(int32 LOD, EMeshSectionIndex SectionIdx,
+                                    const MeshBricks &Bricks, const TArray<FVector> &Positions,
+                                    const TArray<FVector> &Normals, const TArray<FVector2D> &UVs,
+                                    const TArray<int32> &Indices) {
+    struct Section {
+        TArray<FVector> Positions;
+        TArray<FVector> Normals;
+        TArray<FVector2D> UVs;
+        TArray<int32> Indices;
+        uint64 TopologyHash;
+        uint64 ContentHash;
+    };
+    auto idx = static_cast<int32>(SectionIdx);
+    TArray<Section> sections;
+    sections.SetNum(Bricks.BrickIDs.Num());
+    ParallelFor(sections.Num(), [&](int32 brickIdx) {
+        auto &section = sections[brickIdx];
+        auto vertIDs = Bricks.GetVertices(brickIdx);
+        section.Positions.SetNumUninitialized(vertIDs.Num());
+        section.Normals.SetNumUninitialized(vertIDs.Num());
+        section.UVs.SetNumUninitialized(vertIDs.Num());
+        for (int32 i = 0; i < vertIDs.Num(); ++i) {
+            section.Positions[i] = Positions[vertIDs[i]];
+            section.Normals[i] = Normals[vertIDs[i]];
+            section.UVs[i] = UVs[vertIDs[i]];
+        }
+
+        auto indexStart = Bricks.TriOffsets[brickIdx] * 3;
+        section.Indices.SetNumUninitialized(Bricks.TriOffsets[brickIdx + 1] * 3 - indexStart);
+        for (int32 i = 0; i < section.Indices.Num(); ++i)
+            section.Indices[i] = Algo::LowerBound(vertIDs, Indices[indexStart + i]);
+
+        FXxHash64Builder topology;
+        topology.Update(section.Indices.GetData(), sizeof(int32) * section.Indices.Num());
+        section.TopologyHash = topology.Finalize().Hash ^ vertIDs.Num();
+        FXxHash64Builder content;
+        content.Update(section.Positions.GetData(), sizeof(FVector) * section.Positions.Num());
+        content.Update(section.Normals.GetData(), sizeof(FVector) * section.Normals.Num());
+        content.Update(section.UVs.GetData(), sizeof(FVector2D) * section.UVs.Num());
+        section.ContentHash = content.Finalize().Hash;
+    });
+
+    for (int32 brickIdx = 0; brickIdx < sections.Num(); ++brickIdx) {
+        FIntPoint key(LOD, Bricks.BrickIDs[brickIdx]);
+        auto &component = brickComponents.FindOrAdd(key);
+        if (!component) {
+            component = NewObject<UProceduralMeshComponent>(this);
+            component->SetupAttachment(MeshComponent);
+            component->RegisterComponent();
+            if (MaterialInstanceDynamic) {
+                component->SetMaterial(0, MaterialInstanceDynamic);
+                component->SetMaterial(1, MaterialInstanceDynamic);
+            }
+        }
+
+        auto &section = sections[brickIdx];
+        auto &hashes = brickSectionHashes.FindOrAdd(key);
+        if (hashes.Topology[idx] != section.TopologyHash)
+            component->CreateMeshSection(idx, section.Positions, section.Indices,
+                                         section.Normals, section.UVs, TArray<FColor>(),
+                                         TArray<FProcMeshTangent>(), false);
+        else if (hashes.Content[idx] != section.ContentHash)
+            component->UpdateMeshSection(idx, section.Positions, section.Normals, section.UVs,
+                                         TArray<FColor>(), TArray<FProcMeshTangent>());
+        hashes.Topology[idx] = section.TopologyHash;
+        hashes.Content[idx] = section.ContentHash;
+    }
+}
 
 void AMCCActor::updateMesh() {
-    if (MeshComponent->GetNumSections() == 0)
+    if (brickComponents.IsEmpty())
         return;
 
     auto setSectionVisibility = [&](EMeshSectionIndex idx, bool visibility) {
-        auto *section = MeshComponent->GetProcMeshSection(static_cast<int>(idx));
-        if (section)
-            section->bSectionVisible = visibility;
+        // Coarser LODs are not smoothed
+        for (auto &[key, component] : brickComponents)
+            if (key.X == 0 &&
+                component->IsMeshSectionVisible(static_cast<int>(idx)) != visibility)
+                component->SetMeshSectionVisible(static_cast<int>(idx), visibility);
     };
 
     switch (MeshSmoothType) {
@@ -368,6 +1059,10 @@ void AMCCActor::updateMaterialInstanceDynamic() {
                             : VolumeComponent->DefaultTransferFunctionTexture);
         MeshComponent->SetMaterial(0, MaterialInstanceDynamic);
         MeshComponent->SetMaterial(1, MaterialInstanceDynamic);
+        for (auto &[key, component] : brickComponents) {
+            component->SetMaterial(0, MaterialInstanceDynamic);
+            component->SetMaterial(1, MaterialInstanceDynamic);
+        }
     } else {
         UE_LOG(LogStats, Error, TEXT("AMCCActor lost MaterialInstanceDynamic."));
     }
@@ -375,69 +1070,136 @@ void AMCCActor::updateMaterialInstanceDynamic() {
 
 void AMCCActor::generateSmoothedMeshThenUpdateMesh(bool ShouldReGen) {
     if (MeshSmoothType == EMCCMeshSmoothType::None ||
-        (prevMeshSmoothType == MeshSmoothType && !ShouldReGen)) {
+        (prevMeshSmoothType == MeshSmoothType && !ShouldReGen) || indices.IsEmpty()) {
         updateMesh();
         return;
     }
 
-    auto laplacian = [&]() {
-        positionsSmoothed = positions;
-        normalsSmoothed = normals;
+    static constexpr int32 VertBatchSize = 4096;
+    auto vertNum = positions.Num();
+    auto forEachVertexBatch = [&](auto &&Func) {
+        ParallelFor(FMath::DivideAndRoundUp(vertNum, VertBatchSize), [&](int32 batchIdx) {
+            Func(batchIdx, batchIdx * VertBatchSize,
+                 std::min((batchIdx + 1) * VertBatchSize, vertNum));
+        });
+    };
 
-        for (int32 vertID = 0; vertID < positions.Num(); ++vertID) {
-            auto itr = edges.lower_bound(Edge{vertID, 0});
+    // Coordinates of positions along each axis, in 2 buffers swapped by iterations
+    std::array<std::array<TArray<double>, 3>, 2> coords;
+    for (auto &buf : coords)
+        for (auto &axis : buf)
+            axis.SetNumUninitialized(vertNum);
+    forEachVertexBatch([&](int32, int32 Start, int32 End) {
+        for (int32 vertID = Start; vertID < End; ++vertID)
+            for (int32 i = 0; i < 3; ++i)
+                coords[0][i][vertID] = positions[vertID][i];
+    });
+    int32 srcBufIdx = 0;
 
-            auto &positionSmoothed = positionsSmoothed[vertID];
-            auto &normalSmoothed = normalsSmoothed[vertID];
-            int32 adjNum = 1;
-            while (itr != edges.end() && itr->VertIDs[0] == vertID) {
-                positionSmoothed += positions[itr->VertIDs[1]];
-                normalSmoothed += normals[itr->VertIDs[1]];
+    // Moves each vertex from the source buffer into the other one, and returns the squared
+    // maximum of distances moved
+    enum class EStep { Laplacian, Umbrella, Curvature };
+    TArray<double> batchMaxDistSqrs;
+    batchMaxDistSqrs.SetNumUninitialized(FMath::DivideAndRoundUp(vertNum, VertBatchSize));
+    auto step = [&](EStep Step, double Factor) {
+        auto &src = coords[srcBufIdx];
+        auto &dst = coords[srcBufIdx ^ 1];
+        forEachVertexBatch([&](int32 BatchIdx, int32 Start, int32 End) {
+            auto maxDistSqr = 0.;
+            for (int32 vertID = Start; vertID < End; ++vertID) {
+                FVector position(src[0][vertID], src[1][vertID], src[2][vertID]);
+                FVector adjSum = FVector::Zero();
+                auto adjNum = adjacency.GetNeighborNum(vertID);
+                for (auto adjVertID : adjacency.GetNeighbors(vertID))
+                    adjSum += FVector(src[0][adjVertID], src[1][adjVertID], src[2][adjVertID]);
+
+                auto positionSmoothed = position;
+                switch (Step) {
+                case EStep::Laplacian:
+                    positionSmoothed = (position + adjSum) / (adjNum + 1);
+                    break;
+                case EStep::Umbrella:
+                    if (adjNum != 0)
+                        positionSmoothed += Factor * (adjSum / adjNum - position);
+                    break;
+                case EStep::Curvature: {
+                    // Along the normal of the unsmoothed mesh
+                    const auto &normal = normals[vertID];
+                    auto projLen = FVector::DotProduct(adjSum - adjNum * position, normal);
+                    positionSmoothed += projLen / (adjNum + 1) * normal;
+                } break;
+                }
 
-                ++itr;
-                ++adjNum;
+                for (int32 i = 0; i < 3; ++i)
+                    dst[i][vertID] = positionSmoothed[i];
+                maxDistSqr =
+                    std::max(maxDistSqr, FVector::DistSquared(positionSmoothed, position));
             }
-            positionSmoothed /= adjNum;
-            normalSmoothed.Normalize();
-        }
+            batchMaxDistSqrs[BatchIdx] = maxDistSqr;
+        });
+        srcBufIdx ^= 1;
+
+        auto maxDistSqr = 0.;
+        for (auto batchMaxDistSqr : batchMaxDistSqrs)
+            maxDistSqr = std::max(maxDistSqr, batchMaxDistSqr);
+        return maxDistSqr;
     };
-    auto curvature = [&]() {
-        positionsSmoothed.SetNum(positions.Num());
-        normalsSmoothed.SetNum(positions.Num());
 
-        for (int32 vertID = 0; vertID < positions.Num(); ++vertID) {
-            auto itr = edges.lower_bound(Edge{vertID, 0});
+    auto convergenceSqr = static_cast<double>(MeshSmoothConvergence) * MeshSmoothConvergence;
+    for (int32 itr = 0; itr < MeshSmoothIterationNum; ++itr) {
+        double maxDistSqr;
+        switch (MeshSmoothType) {
+        case EMCCMeshSmoothType::Laplacian:
+            maxDistSqr = step(EStep::Laplacian, 1.);
+            break;
+        case EMCCMeshSmoothType::Curvature:
+            maxDistSqr = step(EStep::Curvature, 1.);
+            break;
+        case EMCCMeshSmoothType::Taubin:
+            // Bounded by the sum of the distances of both steps
+            maxDistSqr = FMath::Square(FMath::Sqrt(step(EStep::Umbrella, TaubinLambda)) +
+                                       FMath::Sqrt(step(EStep::Umbrella, TaubinMu)));
+            break;
+        default:
+            maxDistSqr = 0.;
+        }
+        if (maxDistSqr <= convergenceSqr)
+            break;
+    }
+
+    positionsSmoothed.SetNumUninitialized(vertNum);
+    normalsSmoothed.SetNumUninitialized(vertNum);
+    forEachVertexBatch([&](int32, int32 Start, int32 End) {
+        for (int32 vertID = Start; vertID < End; ++vertID)
+            positionsSmoothed[vertID] = FVector(coords[srcBufIdx][0][vertID],
+                                                coords[srcBufIdx][1][vertID],
+                                                coords[srcBufIdx][2][vertID]);
+    });
 
-            const auto &position = positions[vertID];
-            const auto &normal = normals[vertID];
-            auto &positionSmoothed = positionsSmoothed[vertID];
+    // Normals of triangles in CW order, gathered by vertices
+    TArray<FVector> triNormals;
+    triNormals.SetNumUninitialized(indices.Num() / 3);
+    ParallelFor(FMath::DivideAndRoundUp(triNormals.Num(), VertBatchSize), [&](int32 batchIdx) {
+        auto end = std::min((batchIdx + 1) * VertBatchSize, triNormals.Num());
+        for (int32 triID = batchIdx * VertBatchSize; triID < end; ++triID) {
+            const auto &p0 = positionsSmoothed[indices[triID * 3]];
+            auto e0 = positionsSmoothed[indices[triID * 3 + 2]] - p0;
+            auto e1 = positionsSmoothed[indices[triID * 3 + 1]] - p0;
+            triNormals[triID] = FVector::CrossProduct(e0, e1).GetSafeNormal();
+        }
+    });
+    forEachVertexBatch([&](int32, int32 Start, int32 End) {
+        for (int32 vertID = Start; vertID < End; ++vertID) {
             auto &normalSmoothed = normalsSmoothed[vertID];
-            auto projLen = 0.;
-            int32 adjNum = 1;
-            while (itr != edges.end() && itr->VertIDs[0] == vertID) {
-                projLen += FVector::DotProduct(positions[itr->VertIDs[1]] - position, normal);
-
-                ++itr;
-                ++adjNum;
-            }
-            projLen /= adjNum;
-            positionSmoothed = position + projLen * normal;
-            normalSmoothed = normal;
+            normalSmoothed = FVector::Zero();
+            for (auto triID : adjacency.GetTriangles(vertID))
+                normalSmoothed += triNormals[triID];
+            normalSmoothed.Normalize();
         }
-    };
-
-    switch (MeshSmoothType) {
-    case EMCCMeshSmoothType::Laplacian:
-        laplacian();
-        break;
-    case EMCCMeshSmoothType::Curvature:
-        curvature();
-        break;
-    }
+    });
 
-    MeshComponent->CreateMeshSection(static_cast<int>(EMeshSectionIndex::Smoothed), positions,
-                                     indices, normals, uvs, TArray<FColor>(),
-                                     TArray<FProcMeshTangent>(), false);
+    uploadBrickSections(0, EMeshSectionIndex::Smoothed, bricks, positionsSmoothed, normalsSmoothed,
+                        uvs, indices);
 
     updateMesh();
     prevMeshSmoothType = MeshSmoothType;
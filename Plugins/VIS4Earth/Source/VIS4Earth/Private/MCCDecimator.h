@@ -0,0 +1,361 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <array>
+#include <queue>
+#include <vector>
+
+#include "Algo/BinarySearch.h"
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+/*
+ * Class: FMCCDecimator
+ * Function:
+ * -- Decimates a triangle mesh by quadric-error edge collapse, in parallel over clusters of its
+ *    triangles, e.g. bricks of AMCCActor.
+ * -- A collapse merges a vertex into one of its neighbors, which keeps its position, normal and
+ *    UV, at the cost of the sum of quadrics of both vertices there. Cheaper collapses go first.
+ * -- Vertices shared by clusters and those on boundaries of clusters are locked, so that seams
+ *    between clusters and boundaries of the mesh are kept and clusters are independent.
+ * -- Collapses breaking the link condition, flipping triangles or joining shared vertices with
+ *    new edges are skipped.
+ */
+class FMCCDecimator {
+  public:
+    struct Parameters {
+        // Each cluster is decimated to at least ceil(TargetRatio * its triangles), in (0, 1]
+        float TargetRatio;
+        // In units of positions. Collapses moving vertices farther, in root mean square distance
+        // to planes of their triangles weighted by area, are not taken. Not bounded if <= 0.
+        float MaxError = 0.f;
+        // Triangles of cluster C are ClusterTriOffsets[C] to ClusterTriOffsets[C + 1] - 1, and
+        // its vertices ClusterVertIDs[ClusterVertOffsets[C]] to
+        // ClusterVertIDs[ClusterVertOffsets[C + 1] - 1] in ascending order
+        TArrayView<const int32> ClusterTriOffsets;
+        TArrayView<const int32> ClusterVertOffsets;
+        TArrayView<const int32> ClusterVertIDs;
+        // Checked per cluster. Returns false at once if it returns true.
+        TFunction<bool()> IsCancelled;
+    };
+
+    // Normals are optional. Vertices left without triangles are removed, and the others keep
+    // their order, as do remaining triangles, which stay in their clusters.
+    static bool Exec(const Parameters &Params, TArray<FVector> &Positions,
+                     TArray<FVector> &Normals, TArray<FVector2D> &UVs, TArray<int32> &Indices) {
+        auto isCancelled = [&]() { return Params.IsCancelled && Params.IsCancelled(); };
+        auto clusterNum = Params.ClusterTriOffsets.Num() - 1;
+        if (clusterNum <= 0)
+            return true;
+
+        // Vertices referenced by more than one cluster are Shared
+        TArray<int32> owners;
+        owners.Init(INDEX_NONE, Positions.Num());
+        ParallelFor(clusterNum, [&](int32 clusterIdx) {
+            for (int32 i = Params.ClusterVertOffsets[clusterIdx];
+                 i < Params.ClusterVertOffsets[clusterIdx + 1]; ++i) {
+                auto vertID = Params.ClusterVertIDs[i];
+                auto prevOwner =
+                    FPlatformAtomics::InterlockedCompareExchange(&owners[vertID], clusterIdx,
+                                                                 INDEX_NONE);
+                if (prevOwner != INDEX_NONE && prevOwner != clusterIdx)
+                    FPlatformAtomics::InterlockedExchange(&owners[vertID], Shared);
+            }
+        });
+
+        TArray<TArray<int32>> clusterIndices;
+        clusterIndices.SetNum(clusterNum);
+        ParallelFor(clusterNum, [&](int32 clusterIdx) {
+            if (isCancelled())
+                return;
+            decimateCluster(Params, clusterIdx, owners, Positions, Indices,
+                            clusterIndices[clusterIdx]);
+        });
+        if (isCancelled())
+            return false;
+
+        // Compacts vertices left with triangles, in place as they only move forward
+        int32 indexNum = 0;
+        for (auto &indices : clusterIndices) {
+            FMemory::Memcpy(Indices.GetData() + indexNum, indices.GetData(),
+                            sizeof(int32) * indices.Num());
+            indexNum += indices.Num();
+        }
+        Indices.SetNum(indexNum, false);
+
+        TArray<int32> newVertIDs;
+        newVertIDs.Init(INDEX_NONE, Positions.Num());
+        for (auto vertID : Indices)
+            newVertIDs[vertID] = 0;
+        int32 vertNum = 0;
+        for (int32 vertID = 0; vertID < newVertIDs.Num(); ++vertID) {
+            if (newVertIDs[vertID] == INDEX_NONE)
+                continue;
+            newVertIDs[vertID] = vertNum;
+            Positions[vertNum] = Positions[vertID];
+            if (!Normals.IsEmpty())
+                Normals[vertNum] = Normals[vertID];
+            UVs[vertNum] = UVs[vertID];
+            ++vertNum;
+        }
+        Positions.SetNum(vertNum, false);
+        if (!Normals.IsEmpty())
+            Normals.SetNum(vertNum, false);
+        UVs.SetNum(vertNum, false);
+        for (auto &vertID : Indices)
+            vertID = newVertIDs[vertID];
+
+        return true;
+    }
+
+  private:
+    static constexpr int32 Shared = INDEX_NONE - 1;
+
+    // Symmetric 4x4 matrix of the weighted sum of squared distances to planes, in its upper
+    // triangle, along with the sum of weights
+    struct Quadric {
+        std::array<double, 10> M = {0., 0., 0., 0., 0., 0., 0., 0., 0., 0.};
+        double Weight = 0.;
+
+        static Quadric FromPlane(const FVector &Normal, double D, double PlaneWeight) {
+            auto &n = Normal;
+            auto w = PlaneWeight;
+            return {{w * n.X * n.X, w * n.X * n.Y, w * n.X * n.Z, w * n.X * D, w * n.Y * n.Y,
+                     w * n.Y * n.Z, w * n.Y * D, w * n.Z * n.Z, w * n.Z * D, w * D * D},
+                    w};
+        }
+        Quadric &operator+=(const Quadric &Other) {
+            for (int32 i = 0; i < 10; ++i)
+                M[i] += Other.M[i];
+            Weight += Other.Weight;
+            return *this;
+        }
+        double Evaluate(const FVector &P) const {
+            return M[0] * P.X * P.X + 2. * M[1] * P.X * P.Y + 2. * M[2] * P.X * P.Z +
+                   2. * M[3] * P.X + M[4] * P.Y * P.Y + 2. * M[5] * P.Y * P.Z + 2. * M[6] * P.Y +
+                   M[7] * P.Z * P.Z + 2. * M[8] * P.Z + M[9];
+        }
+        // Mean squared distance, in squared units of positions regardless of areas
+        double EvaluateMean(const FVector &P) const {
+            return Weight > 0. ? Evaluate(P) / Weight : 0.;
+        }
+    };
+
+    // Of merging vertex From into vertex To, valid while both are not touched since
+    struct Collapse {
+        // Area-weighted, so that collapses over small triangles go first
+        double Cost;
+        double MeanSquaredError;
+        int32 From;
+        int32 To;
+        uint32 FromStamp;
+        uint32 ToStamp;
+
+        bool operator>(const Collapse &Other) const { return Cost > Other.Cost; }
+    };
+
+    static void decimateCluster(const Parameters &Params, int32 ClusterIdx,
+                                const TArray<int32> &Owners, const TArray<FVector> &Positions,
+                                const TArray<int32> &Indices, TArray<int32> &OutIndices) {
+        auto vertIDs = Params.ClusterVertIDs.Slice(
+            Params.ClusterVertOffsets[ClusterIdx],
+            Params.ClusterVertOffsets[ClusterIdx + 1] - Params.ClusterVertOffsets[ClusterIdx]);
+        auto vertNum = vertIDs.Num();
+        auto triStart = Params.ClusterTriOffsets[ClusterIdx];
+        auto triNum = Params.ClusterTriOffsets[ClusterIdx + 1] - triStart;
+
+        // Triangles and vertices of the cluster, indexed locally
+        TArray<std::array<int32, 3>> tris;
+        tris.SetNumUninitialized(triNum);
+        for (int32 triIdx = 0; triIdx < triNum; ++triIdx)
+            for (int32 i = 0; i < 3; ++i)
+                tris[triIdx][i] = Algo::LowerBound(vertIDs, Indices[(triStart + triIdx) * 3 + i]);
+        TArray<bool> triAlives;
+        triAlives.Init(true, triNum);
+        TArray<TArray<int32>> vertTris;
+        vertTris.SetNum(vertNum);
+        for (int32 triIdx = 0; triIdx < triNum; ++triIdx)
+            for (auto vertIdx : tris[triIdx])
+                vertTris[vertIdx].Emplace(triIdx);
+        auto getPos = [&](int32 VertIdx) -> const FVector & {
+            return Positions[vertIDs[VertIdx]];
+        };
+
+        // Area-weighted quadrics of planes of triangles
+        TArray<Quadric> quadrics;
+        quadrics.SetNum(vertNum);
+        for (auto &tri : tris) {
+            auto normal = FVector::CrossProduct(getPos(tri[1]) - getPos(tri[0]),
+                                                getPos(tri[2]) - getPos(tri[0]));
+            auto area = .5 * normal.Size();
+            if (area <= UE_DOUBLE_SMALL_NUMBER)
+                continue;
+            normal /= 2. * area;
+            auto quadric = Quadric::FromPlane(normal, -FVector::DotProduct(normal, getPos(tri[0])),
+                                              area);
+            for (auto vertIdx : tri)
+                quadrics[vertIdx] += quadric;
+        }
+
+        // Edges of one triangle are on boundaries, whose vertices are locked along with shared
+        TArray<bool> vertLocks;
+        vertLocks.SetNumUninitialized(vertNum);
+        for (int32 vertIdx = 0; vertIdx < vertNum; ++vertIdx)
+            vertLocks[vertIdx] = Owners[vertIDs[vertIdx]] == Shared;
+        TArray<uint64> edges;
+        edges.SetNumUninitialized(triNum * 3);
+        for (int32 triIdx = 0; triIdx < triNum; ++triIdx)
+            for (int32 i = 0; i < 3; ++i) {
+                auto v0 = tris[triIdx][i];
+                auto v1 = tris[triIdx][(i + 1) % 3];
+                edges[triIdx * 3 + i] =
+                    (static_cast<uint64>(std::min(v0, v1)) << 32) | std::max(v0, v1);
+            }
+        edges.Sort();
+        for (int32 i = 0; i < edges.Num();) {
+            auto end = i + 1;
+            while (end < edges.Num() && edges[end] == edges[i])
+                ++end;
+            if (end - i == 1) {
+                vertLocks[static_cast<int32>(edges[i] >> 32)] = true;
+                vertLocks[static_cast<int32>(edges[i] & 0xffffffff)] = true;
+            }
+            i = end;
+        }
+
+        auto maxMeanSquaredError = Params.MaxError > 0.f
+                                       ? static_cast<double>(Params.MaxError) * Params.MaxError
+                                       : std::numeric_limits<double>::max();
+        TArray<uint32> stamps;
+        stamps.Init(0, vertNum);
+        TArray<bool> vertAlives;
+        vertAlives.Init(true, vertNum);
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> collapses;
+        auto push = [&](int32 From, int32 To) {
+            if (vertLocks[From])
+                return;
+            auto quadric = quadrics[From];
+            quadric += quadrics[To];
+            auto &pos = getPos(To);
+            collapses.push({quadric.Evaluate(pos), quadric.EvaluateMean(pos), From, To,
+                            stamps[From], stamps[To]});
+        };
+        for (int32 i = 0; i < edges.Num(); ++i) {
+            if (i != 0 && edges[i] == edges[i - 1])
+                continue;
+            auto v0 = static_cast<int32>(edges[i] >> 32);
+            auto v1 = static_cast<int32>(edges[i] & 0xffffffff);
+            push(v0, v1);
+            push(v1, v0);
+        }
+
+        auto getNeighbors = [&](int32 VertIdx) {
+            TArray<int32> neighbors;
+            for (auto triIdx : vertTris[VertIdx])
+                if (triAlives[triIdx])
+                    for (auto vertIdx : tris[triIdx])
+                        if (vertIdx != VertIdx)
+                            neighbors.Emplace(vertIdx);
+            neighbors.Sort();
+            auto *last = std::unique(neighbors.GetData(), neighbors.GetData() + neighbors.Num());
+            neighbors.SetNum(last - neighbors.GetData());
+            return neighbors;
+        };
+        auto contains = [&](int32 TriIdx, int32 VertIdx) {
+            auto &tri = tris[TriIdx];
+            return tri[0] == VertIdx || tri[1] == VertIdx || tri[2] == VertIdx;
+        };
+        auto isCollapsible = [&](int32 From, int32 To) {
+            // Link condition: common neighbors of the edge are the ones opposite to it
+            TArray<int32> opposites;
+            for (auto triIdx : vertTris[From])
+                if (triAlives[triIdx] && contains(triIdx, To))
+                    for (auto vertIdx : tris[triIdx])
+                        if (vertIdx != From && vertIdx != To)
+                            opposites.Emplace(vertIdx);
+            opposites.Sort();
+            auto fromNeighbors = getNeighbors(From);
+            auto toNeighbors = getNeighbors(To);
+            int32 commonNum = 0;
+            for (auto vertIdx : fromNeighbors)
+                if (Algo::BinarySearch(toNeighbors, vertIdx) != INDEX_NONE) {
+                    if (Algo::BinarySearch(opposites, vertIdx) == INDEX_NONE)
+                        return false;
+                    ++commonNum;
+                }
+            if (commonNum != opposites.Num())
+                return false;
+
+            // Other clusters may join the same shared vertices with an edge
+            if (Owners[vertIDs[To]] == Shared)
+                for (auto vertIdx : fromNeighbors)
+                    if (vertIdx != To && Owners[vertIDs[vertIdx]] == Shared &&
+                        Algo::BinarySearch(toNeighbors, vertIdx) == INDEX_NONE)
+                        return false;
+
+            // Triangles moved with From may not flip or degenerate
+            for (auto triIdx : vertTris[From]) {
+                if (!triAlives[triIdx] || contains(triIdx, To))
+                    continue;
+                auto tri = tris[triIdx];
+                auto prevNormal = FVector::CrossProduct(getPos(tri[1]) - getPos(tri[0]),
+                                                        getPos(tri[2]) - getPos(tri[0]));
+                for (auto &vertIdx : tri)
+                    if (vertIdx == From)
+                        vertIdx = To;
+                auto normal = FVector::CrossProduct(getPos(tri[1]) - getPos(tri[0]),
+                                                    getPos(tri[2]) - getPos(tri[0]));
+                if (FVector::DotProduct(normal.GetSafeNormal(), prevNormal.GetSafeNormal()) <= .2)
+                    return false;
+            }
+            return true;
+        };
+
+        auto targetTriNum = FMath::CeilToInt32(Params.TargetRatio * triNum);
+        auto aliveTriNum = triNum;
+        while (aliveTriNum > targetTriNum && !collapses.empty()) {
+            auto collapse = collapses.top();
+            collapses.pop();
+            if (!vertAlives[collapse.From] || !vertAlives[collapse.To] ||
+                stamps[collapse.From] != collapse.FromStamp ||
+                stamps[collapse.To] != collapse.ToStamp)
+                continue;
+            // Costs are weighted by areas and errors are not, so later collapses may still fit
+            if (collapse.MeanSquaredError > maxMeanSquaredError ||
+                !isCollapsible(collapse.From, collapse.To))
+                continue;
+
+            for (auto triIdx : vertTris[collapse.From]) {
+                if (!triAlives[triIdx])
+                    continue;
+                if (contains(triIdx, collapse.To)) {
+                    triAlives[triIdx] = false;
+                    --aliveTriNum;
+                    continue;
+                }
+                for (auto &vertIdx : tris[triIdx])
+                    if (vertIdx == collapse.From)
+                        vertIdx = collapse.To;
+                vertTris[collapse.To].Emplace(triIdx);
+            }
+            vertTris[collapse.To].RemoveAllSwap(
+                [&](int32 TriIdx) { return !triAlives[TriIdx]; }, false);
+            vertTris[collapse.From].Empty();
+            vertAlives[collapse.From] = false;
+            quadrics[collapse.To] += quadrics[collapse.From];
+            ++stamps[collapse.To];
+
+            for (auto vertIdx : getNeighbors(collapse.To)) {
+                push(vertIdx, collapse.To);
+                push(collapse.To, vertIdx);
+            }
+        }
+
+        OutIndices.Reserve(aliveTriNum * 3);
+        for (int32 triIdx = 0; triIdx < triNum; ++triIdx)
+            if (triAlives[triIdx])
+                for (auto vertIdx : tris[triIdx])
+                    OutIndices.Emplace(vertIDs[vertIdx]);
+    }
+};
@@ -0,0 +1,323 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <array>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Data.h"
+#include "MCCTable.h"
+#include "VolumeBrickCache.h"
+#include "VolumeGradient.h"
+
+/*
+ * Class: FMCCFlyingEdges
+ * Function:
+ * -- Implements Flying Edges Isosurface Generation, which generates the same vertices and
+ *    triangles as the marching cubes of AMCCActor in another order.
+ * -- Pass 1 classifies voxels of each row along X and trims the row to its cut X edges.
+ * -- Pass 2 trims each row of cells to the rows of voxels around it, and counts its triangles
+ *    and the cut Y and Z edges of voxels it owns.
+ * -- Pass 3 sums counts up into offsets of rows, so that outputs are allocated in exact sizes.
+ * -- Pass 4 generates vertices and triangles of each row of cells into its own ranges.
+ * -- Each voxel owns its edges along +X, +Y and +Z. Each row of cells owns the row of voxels at
+ *    its origin, and those above and behind it on the last layer and row respectively.
+ */
+class FMCCFlyingEdges {
+  public:
+    struct Parameters {
+        FIntVector3 Dimension;
+        // Cells starting at Z in [HeightRange[0], HeightRange[1]) are marched
+        FIntVector2 HeightRange;
+        float IsoValue;
+        bool UseLerp;
+        // Maps scalars of vertices to UVs in [0, 1]
+        float VoxelMin;
+        float VoxelExtent;
+        // Generates gradients of the volume as normals, from Gradient if it is not nullptr
+        bool GenGradientNormals = false;
+        const FVolumeGradient *Gradient = nullptr;
+        // Checked per row. Returns false at once if it returns true.
+        TFunction<bool()> IsCancelled;
+    };
+    // Arrays are resized without shrinking, so that buffers passed in are reused
+    struct Output {
+        // On the voxel grid
+        TArray<FVector> Positions;
+        TArray<FVector> Normals;
+        TArray<FVector2D> UVs;
+        // In CCW order
+        TArray<int32> Indices;
+    };
+
+    template <SupportedVoxelType T>
+    static bool Exec(const Parameters &Params, const FVolumeSampler &Sampler, Output &Out) {
+        auto &dim = Params.Dimension;
+        auto zMin = Params.HeightRange[0];
+        auto zMax = Params.HeightRange[1];
+        if (dim.X < 2 || dim.Y < 2 || zMin < 0 || zMax <= zMin || zMax >= dim.Z) {
+            // Buffers passed in are not outputs of this call
+            Out.Positions.SetNum(0, false);
+            Out.Normals.SetNum(0, false);
+            Out.UVs.SetNum(0, false);
+            Out.Indices.SetNum(0, false);
+            return true;
+        }
+
+        auto isCancelled = [&]() { return Params.IsCancelled && Params.IsCancelled(); };
+
+        // Rows of voxels on layers in [zMin, zMax], and rows of cells on layers in [zMin, zMax)
+        auto rowNum = dim.Y * (zMax - zMin + 1);
+        auto cellRowNum = (dim.Y - 1) * (zMax - zMin);
+        auto getRowIdx = [&](int32 Y, int32 Z) { return (Z - zMin) * dim.Y + Y; };
+
+        struct Row {
+            // Cut X edges start at voxels in [XMin, XMax)
+            int32 XMin;
+            int32 XMax;
+            int32 XCutNum = 0;
+            int32 YCutNum = 0;
+            int32 ZCutNum = 0;
+            // Of vertices on X edges, followed by those on Y and Z edges
+            int32 VertOffset = 0;
+        };
+        struct CellRow {
+            // Cells in [XMin, XMax) may have triangles
+            int32 XMin = 0;
+            int32 XMax = 0;
+            int32 TriOffset = 0;
+        };
+        TArray<Row> rows;
+        TArray<CellRow> cellRows;
+        TArray<int32> cellRowTriNums;
+        rows.SetNum(rowNum);
+        cellRows.SetNum(cellRowNum);
+        cellRowTriNums.Init(0, cellRowNum);
+        // Whether voxels are not less than IsoValue
+        TArray64<uint8> insides;
+        insides.SetNumUninitialized(static_cast<int64>(rowNum) * dim.X);
+        auto getInsides = [&](int32 RowIdx) {
+            return insides.GetData() + static_cast<int64>(RowIdx) * dim.X;
+        };
+
+        // Pass 1
+        ParallelFor(rowNum, [&](int32 rowIdx) {
+            if (isCancelled())
+                return;
+
+            auto sampler = Sampler;
+            FIntVector3 pos(0, rowIdx % dim.Y, zMin + rowIdx / dim.Y);
+            auto rowInsides = getInsides(rowIdx);
+            for (; pos.X < dim.X; ++pos.X)
+                rowInsides[pos.X] = sampler.Sample<T>(pos) >= Params.IsoValue ? 1 : 0;
+
+            auto &row = rows[rowIdx];
+            row.XMin = dim.X - 1;
+            row.XMax = 0;
+            for (int32 x = 0; x < dim.X - 1; ++x)
+                if (rowInsides[x] != rowInsides[x + 1]) {
+                    ++row.XCutNum;
+                    row.XMin = std::min(row.XMin, x);
+                    row.XMax = x + 1;
+                }
+        });
+        if (isCancelled())
+            return false;
+
+        // Pass 2
+        ParallelFor(cellRowNum, [&](int32 cellRowIdx) {
+            if (isCancelled())
+                return;
+
+            auto y = cellRowIdx % (dim.Y - 1);
+            auto z = zMin + cellRowIdx / (dim.Y - 1);
+            std::array rowIdxs = {getRowIdx(y, z), getRowIdx(y + 1, z), getRowIdx(y, z + 1),
+                                  getRowIdx(y + 1, z + 1)};
+            std::array<const uint8 *, 4> rowInsides;
+            auto &cellRow = cellRows[cellRowIdx];
+            cellRow.XMin = dim.X - 1;
+            cellRow.XMax = 0;
+            for (int32 i = 0; i < 4; ++i) {
+                rowInsides[i] = getInsides(rowIdxs[i]);
+                cellRow.XMin = std::min(cellRow.XMin, rows[rowIdxs[i]].XMin);
+                cellRow.XMax = std::max(cellRow.XMax, rows[rowIdxs[i]].XMax);
+            }
+            // Beyond cut X edges, rows are constant but may differ from each other
+            for (int32 i = 1; i < 4; ++i) {
+                if (rowInsides[i][0] != rowInsides[0][0])
+                    cellRow.XMin = 0;
+                if (rowInsides[i][dim.X - 1] != rowInsides[0][dim.X - 1])
+                    cellRow.XMax = dim.X - 1;
+            }
+            if (cellRow.XMin >= cellRow.XMax)
+                return;
+
+            auto countCuts = [&](int32 &CutNum, const uint8 *Insides0, const uint8 *Insides1) {
+                for (int32 x = cellRow.XMin; x <= cellRow.XMax; ++x)
+                    CutNum += Insides0[x] != Insides1[x] ? 1 : 0;
+            };
+            countCuts(rows[rowIdxs[0]].YCutNum, rowInsides[0], rowInsides[1]);
+            countCuts(rows[rowIdxs[0]].ZCutNum, rowInsides[0], rowInsides[2]);
+            if (y == dim.Y - 2)
+                countCuts(rows[rowIdxs[1]].ZCutNum, rowInsides[1], rowInsides[3]);
+            if (z == zMax - 1)
+                countCuts(rows[rowIdxs[2]].YCutNum, rowInsides[2], rowInsides[3]);
+
+            auto &triNum = cellRowTriNums[cellRowIdx];
+            for (int32 x = cellRow.XMin; x < cellRow.XMax; ++x)
+                triNum += GVertNumTable[getCornerState(rowInsides, x)] / 3;
+        });
+        if (isCancelled())
+            return false;
+
+        // Pass 3
+        int32 vertNum = 0;
+        for (auto &row : rows) {
+            row.VertOffset = vertNum;
+            vertNum += row.XCutNum + row.YCutNum + row.ZCutNum;
+        }
+        int32 triNum = 0;
+        for (int32 cellRowIdx = 0; cellRowIdx < cellRowNum; ++cellRowIdx) {
+            cellRows[cellRowIdx].TriOffset = triNum;
+            triNum += cellRowTriNums[cellRowIdx];
+        }
+        Out.Positions.SetNumUninitialized(vertNum, false);
+        Out.UVs.SetNumUninitialized(vertNum, false);
+        Out.Normals.SetNumUninitialized(Params.GenGradientNormals ? vertNum : 0, false);
+        Out.Indices.SetNumUninitialized(triNum * 3, false);
+
+        // Pass 4
+        ParallelFor(cellRowNum, [&](int32 cellRowIdx) {
+            auto &cellRow = cellRows[cellRowIdx];
+            if (cellRow.XMin >= cellRow.XMax || isCancelled())
+                return;
+
+            auto sampler = Sampler;
+            auto y = cellRowIdx % (dim.Y - 1);
+            auto z = zMin + cellRowIdx / (dim.Y - 1);
+            std::array rowIdxs = {getRowIdx(y, z), getRowIdx(y + 1, z), getRowIdx(y, z + 1),
+                                  getRowIdx(y + 1, z + 1)};
+            std::array<const uint8 *, 4> rowInsides;
+            for (int32 i = 0; i < 4; ++i)
+                rowInsides[i] = getInsides(rowIdxs[i]);
+            auto isYOwned = y == dim.Y - 2;
+            auto isZOwned = z == zMax - 1;
+
+            // Vertex IDs of the next cut X edges of rows, and Y and Z edges of rows at 0 and 2,
+            // and 0 and 1 respectively
+            std::array<int32, 4> xVertIDs;
+            std::array<int32, 2> yVertIDs;
+            std::array<int32, 2> zVertIDs;
+            for (int32 i = 0; i < 4; ++i)
+                xVertIDs[i] = rows[rowIdxs[i]].VertOffset;
+            for (int32 i = 0; i < 2; ++i) {
+                auto &yRow = rows[rowIdxs[i * 2]];
+                yVertIDs[i] = yRow.VertOffset + yRow.XCutNum;
+                auto &zRow = rows[rowIdxs[i]];
+                zVertIDs[i] = zRow.VertOffset + zRow.XCutNum + zRow.YCutNum;
+            }
+
+            // From the voxel at VoxPos along Axis, as marching cubes do
+            auto genVertex = [&](int32 VertID, FIntVector3 VoxPos, int32 Axis) {
+                auto nextVoxPos = VoxPos;
+                nextVoxPos[Axis] += 1;
+                auto scalar0 = static_cast<float>(sampler.Sample<T>(VoxPos));
+                auto scalar1 = static_cast<float>(sampler.Sample<T>(nextVoxPos));
+                auto omega = Params.UseLerp ? scalar0 / (scalar1 + scalar0) : .5f;
+
+                FVector pos(VoxPos);
+                pos[Axis] += omega;
+                Out.Positions[VertID] = pos;
+                Out.UVs[VertID] = FVector2D(
+                    (omega * scalar0 + (1.f - omega) * scalar1 - Params.VoxelMin) /
+                        Params.VoxelExtent,
+                    0.f);
+                if (!Params.GenGradientNormals)
+                    return;
+
+                auto getGradient = [&](const FIntVector3 &Pos) {
+                    return Params.Gradient ? Params.Gradient->Get(Pos)
+                                           : FVolumeGradient::Sample<T>(sampler, Pos, dim);
+                };
+                Out.Normals[VertID] =
+                    FVector(FMath::Lerp(getGradient(VoxPos), getGradient(nextVoxPos), omega));
+            };
+
+            auto triID = cellRow.TriOffset;
+            for (int32 x = cellRow.XMin; x < cellRow.XMax; ++x) {
+                auto cornerState = getCornerState(rowInsides, x);
+                auto isCorner = [&](int32 Corner) { return (cornerState >> Corner) & 1; };
+                std::array<bool, 12> cuts;
+                for (int32 ei = 0; ei < 12; ++ei)
+                    cuts[ei] = isCorner(EdgeCorners[ei][0]) != isCorner(EdgeCorners[ei][1]);
+
+                // See the edge numbering of AMCCActor
+                std::array<int32, 12> vertIDs = {xVertIDs[0],
+                                                 yVertIDs[0] + (cuts[3] ? 1 : 0),
+                                                 xVertIDs[1],
+                                                 yVertIDs[0],
+                                                 xVertIDs[2],
+                                                 yVertIDs[1] + (cuts[7] ? 1 : 0),
+                                                 xVertIDs[3],
+                                                 yVertIDs[1],
+                                                 zVertIDs[0],
+                                                 zVertIDs[0] + (cuts[8] ? 1 : 0),
+                                                 zVertIDs[1] + (cuts[11] ? 1 : 0),
+                                                 zVertIDs[1]};
+
+                for (uint32 i = 0; i < GVertNumTable[cornerState]; i += 3) {
+                    for (int32 ii = 0; ii < 3; ++ii)
+                        Out.Indices[triID * 3 + ii] = vertIDs[GEdgeTable[cornerState][i + ii]];
+                    ++triID;
+                }
+
+                // Edges owned by the row of cells, where those at X + 1 are only owned by the
+                // last cell
+                auto isLast = x == cellRow.XMax - 1;
+                auto genOwnedVertex = [&](int32 Edge, bool IsOwned, FIntVector3 VoxPos,
+                                          int32 Axis) {
+                    if (cuts[Edge] && IsOwned)
+                        genVertex(vertIDs[Edge], VoxPos, Axis);
+                };
+                genOwnedVertex(0, true, {x, y, z}, 0);
+                genOwnedVertex(3, true, {x, y, z}, 1);
+                genOwnedVertex(8, true, {x, y, z}, 2);
+                genOwnedVertex(1, isLast, {x + 1, y, z}, 1);
+                genOwnedVertex(9, isLast, {x + 1, y, z}, 2);
+                genOwnedVertex(2, isYOwned, {x, y + 1, z}, 0);
+                genOwnedVertex(11, isYOwned, {x, y + 1, z}, 2);
+                genOwnedVertex(10, isYOwned && isLast, {x + 1, y + 1, z}, 2);
+                genOwnedVertex(4, isZOwned, {x, y, z + 1}, 0);
+                genOwnedVertex(7, isZOwned, {x, y, z + 1}, 1);
+                genOwnedVertex(5, isZOwned && isLast, {x + 1, y, z + 1}, 1);
+                genOwnedVertex(6, isYOwned && isZOwned, {x, y + 1, z + 1}, 0);
+
+                for (int32 i = 0; i < 4; ++i)
+                    xVertIDs[i] += cuts[XEdges[i]] ? 1 : 0;
+                yVertIDs[0] += cuts[3] ? 1 : 0;
+                yVertIDs[1] += cuts[7] ? 1 : 0;
+                zVertIDs[0] += cuts[8] ? 1 : 0;
+                zVertIDs[1] += cuts[11] ? 1 : 0;
+            }
+        });
+
+        return !isCancelled();
+    }
+
+  private:
+    // Voxels at the start and the end of edges, in the numbering of AMCCActor
+    static constexpr std::array<std::array<int32, 2>, 12> EdgeCorners = {
+        {{0, 1}, {1, 2}, {3, 2}, {0, 3}, {4, 5}, {5, 6}, {7, 6}, {4, 7},
+         {0, 4}, {1, 5}, {2, 6}, {3, 7}}};
+    // X edges of rows of voxels at Y, Y + 1 on Z, and at Y, Y + 1 on Z + 1
+    static constexpr std::array<int32, 4> XEdges = {0, 2, 4, 6};
+
+    static uint8 getCornerState(const std::array<const uint8 *, 4> &RowInsides, int32 X) {
+        return static_cast<uint8>(RowInsides[0][X] | (RowInsides[0][X + 1] << 1) |
+                                  (RowInsides[1][X + 1] << 2) | (RowInsides[1][X] << 3) |
+                                  (RowInsides[2][X] << 4) | (RowInsides[2][X + 1] << 5) |
+                                  (RowInsides[3][X + 1] << 6) | (RowInsides[3][X] << 7));
+    }
+};
@@ -0,0 +1,298 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <array>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Data.h"
+#include "VolumeBrickCache.h"
+#include "VolumeGradient.h"
+
+/*
+ * Class: FMCCSurfaceNets
+ * Function:
+ * -- Implements Naive Surface Nets, which generates a vertex in each cell crossed by the
+ *    isosurface, and a quad of 2 triangles across each edge crossed by it. Meshes have about as
+ *    many vertices as those of AMCCActor, whose marching cubes share vertices on edges, but are of
+ *    regular quads without slivers. Most vertices join 4 quads, each split along its diagonal
+ *    from quad[0] to quad[2], so they have about 6 neighbors in the adjacency of triangles.
+ * -- A vertex is at the average of points where the isosurface crosses edges of its cell, which
+ *    are placed as marching cubes of AMCCActor do, and so are its UV and normal.
+ * -- Pass 1 classifies voxels of each layer. Pass 2 counts vertices and quads of each row of
+ *    cells. Pass 3 sums counts up into offsets of rows, so that outputs are allocated in exact
+ *    sizes. Pass 4 generates vertices and quads of each row of cells into its own ranges. Passes
+ *    run in parallel over slabs, each of a layer.
+ * -- Each row of cells owns quads across edges of the row of voxels at its origin, whose 4 cells
+ *    around are all marched. Thus the surface ends at centers of cells on the boundary.
+ */
+class FMCCSurfaceNets {
+  public:
+    struct Parameters {
+        FIntVector3 Dimension;
+        // Cells starting at Z in [HeightRange[0], HeightRange[1]) are marched
+        FIntVector2 HeightRange;
+        float IsoValue;
+        bool UseLerp;
+        // Maps scalars of vertices to UVs in [0, 1]
+        float VoxelMin;
+        float VoxelExtent;
+        // Generates gradients of the volume as normals, from Gradient if it is not nullptr
+        bool GenGradientNormals = false;
+        const FVolumeGradient *Gradient = nullptr;
+        // Checked per slab. Returns false at once if it returns true.
+        TFunction<bool()> IsCancelled;
+    };
+    // Arrays are resized without shrinking, so that buffers passed in are reused
+    struct Output {
+        // On the voxel grid
+        TArray<FVector> Positions;
+        TArray<FVector> Normals;
+        TArray<FVector2D> UVs;
+        // In CCW order
+        TArray<int32> Indices;
+    };
+
+    template <SupportedVoxelType T>
+    static bool Exec(const Parameters &Params, const FVolumeSampler &Sampler, Output &Out) {
+        auto &dim = Params.Dimension;
+        auto zMin = Params.HeightRange[0];
+        auto zMax = Params.HeightRange[1];
+        if (dim.X < 2 || dim.Y < 2 || zMin < 0 || zMax <= zMin || zMax >= dim.Z) {
+            // Buffers passed in are not outputs of this call
+            Out.Positions.SetNum(0, false);
+            Out.Normals.SetNum(0, false);
+            Out.UVs.SetNum(0, false);
+            Out.Indices.SetNum(0, false);
+            return true;
+        }
+
+        auto isCancelled = [&]() { return Params.IsCancelled && Params.IsCancelled(); };
+
+        // Rows of voxels on layers in [zMin, zMax], and rows of cells on layers in [zMin, zMax)
+        struct CellRow {
+            int32 VertNum = 0;
+            int32 QuadNum = 0;
+            int32 VertOffset = 0;
+            int32 QuadOffset = 0;
+        };
+        TArray<CellRow> cellRows;
+        cellRows.SetNum((dim.Y - 1) * (zMax - zMin));
+        auto getCellRow = [&](int32 Y, int32 Z) -> CellRow & {
+            return cellRows[(Z - zMin) * (dim.Y - 1) + Y];
+        };
+        // Whether voxels are not less than IsoValue
+        TArray64<uint8> insides;
+        insides.SetNumUninitialized(static_cast<int64>(zMax - zMin + 1) * dim.Y * dim.X);
+        auto getInsides = [&](int32 Y, int32 Z) {
+            return insides.GetData() + (static_cast<int64>(Z - zMin) * dim.Y + Y) * dim.X;
+        };
+        auto getCellRowInsides = [&](int32 Y, int32 Z) -> std::array<const uint8 *, 4> {
+            return {getInsides(Y, Z), getInsides(Y + 1, Z), getInsides(Y, Z + 1),
+                    getInsides(Y + 1, Z + 1)};
+        };
+
+        // Calls F(X, Axis, IsInside) on each cut edge owned by the row of cells at Y and Z in
+        // ascending X, where IsInside is of the voxel at X
+        auto forEachOwnedCut = [&](int32 Y, int32 Z, auto &&F) {
+            auto rowInsides = getCellRowInsides(Y, Z);
+            auto hasPrevY = Y > 0;
+            auto hasPrevZ = Z > zMin;
+            for (int32 x = 0; x < dim.X - 1; ++x) {
+                auto inside = rowInsides[0][x];
+                if (hasPrevY && hasPrevZ && inside != rowInsides[0][x + 1])
+                    F(x, 0, inside);
+                if (x == 0)
+                    continue;
+                if (hasPrevZ && inside != rowInsides[1][x])
+                    F(x, 1, inside);
+                if (hasPrevY && inside != rowInsides[2][x])
+                    F(x, 2, inside);
+            }
+        };
+
+        // Pass 1
+        ParallelFor(zMax - zMin + 1, [&](int32 slabIdx) {
+            if (isCancelled())
+                return;
+
+            auto sampler = Sampler;
+            auto z = zMin + slabIdx;
+            for (int32 y = 0; y < dim.Y; ++y) {
+                auto rowInsides = getInsides(y, z);
+                for (int32 x = 0; x < dim.X; ++x)
+                    rowInsides[x] = sampler.Sample<T>({x, y, z}) >= Params.IsoValue ? 1 : 0;
+            }
+        });
+        if (isCancelled())
+            return false;
+
+        // Pass 2
+        ParallelFor(zMax - zMin, [&](int32 slabIdx) {
+            if (isCancelled())
+                return;
+
+            auto z = zMin + slabIdx;
+            for (int32 y = 0; y < dim.Y - 1; ++y) {
+                auto &cellRow = getCellRow(y, z);
+                auto rowInsides = getCellRowInsides(y, z);
+                for (int32 x = 0; x < dim.X - 1; ++x)
+                    cellRow.VertNum += isActive(getCornerState(rowInsides, x)) ? 1 : 0;
+                forEachOwnedCut(y, z, [&](int32, int32, uint8) { ++cellRow.QuadNum; });
+            }
+        });
+        if (isCancelled())
+            return false;
+
+        // Pass 3
+        int32 vertNum = 0;
+        int32 quadNum = 0;
+        for (auto &cellRow : cellRows) {
+            cellRow.VertOffset = vertNum;
+            cellRow.QuadOffset = quadNum;
+            vertNum += cellRow.VertNum;
+            quadNum += cellRow.QuadNum;
+        }
+        Out.Positions.SetNumUninitialized(vertNum, false);
+        Out.UVs.SetNumUninitialized(vertNum, false);
+        Out.Normals.SetNumUninitialized(Params.GenGradientNormals ? vertNum : 0, false);
+        Out.Indices.SetNumUninitialized(quadNum * 6, false);
+
+        // Pass 4
+        ParallelFor(zMax - zMin, [&](int32 slabIdx) {
+            if (isCancelled())
+                return;
+
+            auto sampler = Sampler;
+            auto getGradient = [&](const FIntVector3 &Pos) {
+                return Params.Gradient ? Params.Gradient->Get(Pos)
+                                       : FVolumeGradient::Sample<T>(sampler, Pos, dim);
+            };
+
+            auto z = zMin + slabIdx;
+            for (int32 y = 0; y < dim.Y - 1; ++y) {
+                auto &cellRow = getCellRow(y, z);
+                auto rowInsides = getCellRowInsides(y, z);
+
+                auto vertID = cellRow.VertOffset;
+                for (int32 x = 0; x < dim.X - 1; ++x) {
+                    auto cornerState = getCornerState(rowInsides, x);
+                    if (!isActive(cornerState))
+                        continue;
+
+                    std::array<float, 8> scalars;
+                    std::array<FVector3f, 8> gradients;
+                    for (int32 ci = 0; ci < 8; ++ci) {
+                        FIntVector3 cornerPos(x + Corners[ci][0], y + Corners[ci][1],
+                                              z + Corners[ci][2]);
+                        scalars[ci] = static_cast<float>(sampler.Sample<T>(cornerPos));
+                        if (Params.GenGradientNormals)
+                            gradients[ci] = getGradient(cornerPos);
+                    }
+
+                    // Averaged over cut edges, each from its start voxel as marching cubes do
+                    FVector pos(0.);
+                    FVector3f normal(0.f);
+                    float scalar = 0.f;
+                    int32 cutNum = 0;
+                    for (auto &[c0, c1] : EdgeCorners) {
+                        if (((cornerState >> c0) & 1) == ((cornerState >> c1) & 1))
+                            continue;
+
+                        auto omega =
+                            Params.UseLerp ? scalars[c0] / (scalars[c1] + scalars[c0]) : .5f;
+                        for (int32 i = 0; i < 3; ++i)
+                            pos[i] += Corners[c0][i] + omega * (Corners[c1][i] - Corners[c0][i]);
+                        scalar += omega * scalars[c0] + (1.f - omega) * scalars[c1];
+                        if (Params.GenGradientNormals)
+                            normal += FMath::Lerp(gradients[c0], gradients[c1], omega);
+                        ++cutNum;
+                    }
+
+                    Out.Positions[vertID] = FVector(x, y, z) + pos / cutNum;
+                    Out.UVs[vertID] =
+                        FVector2D((scalar / cutNum - Params.VoxelMin) / Params.VoxelExtent, 0.f);
+                    if (Params.GenGradientNormals)
+                        Out.Normals[vertID] = FVector(normal / cutNum);
+                    ++vertID;
+                }
+
+                // Vertex IDs of the next cells of rows at Y - 1 + DY and Z - 1 + DZ, indexed by
+                // DZ * 2 + DY, which advance lazily to cells at X
+                std::array<int32, 4> nextVertIDs = {};
+                std::array<std::array<const uint8 *, 4>, 4> aroundInsides = {};
+                std::array<bool, 4> hasArounds = {};
+                for (int32 i = 0; i < 4; ++i) {
+                    auto aroundY = y - 1 + (i & 1);
+                    auto aroundZ = z - 1 + (i >> 1);
+                    hasArounds[i] = aroundY >= 0 && aroundZ >= zMin;
+                    if (!hasArounds[i])
+                        continue;
+                    nextVertIDs[i] = getCellRow(aroundY, aroundZ).VertOffset;
+                    aroundInsides[i] = getCellRowInsides(aroundY, aroundZ);
+                }
+                int32 nextX = 0;
+                auto advanceTo = [&](int32 X) {
+                    for (; nextX < X; ++nextX)
+                        for (int32 i = 0; i < 4; ++i)
+                            if (hasArounds[i])
+                                nextVertIDs[i] +=
+                                    isActive(getCornerState(aroundInsides[i], nextX)) ? 1 : 0;
+                };
+
+                // Cells around an edge along Axis are in CCW order when looked at from its end,
+                // then reversed if the voxel at its start is inside, so that the quad faces the
+                // inside as triangles of marching cubes do
+                auto quadID = cellRow.QuadOffset;
+                forEachOwnedCut(y, z, [&](int32 X, int32 Axis, uint8 IsInside) {
+                    advanceTo(X);
+                    auto curr = [&](int32 DY, int32 DZ) { return nextVertIDs[DZ * 2 + DY]; };
+                    auto prev = [&](int32 DY, int32 DZ) { return nextVertIDs[DZ * 2 + DY] - 1; };
+                    std::array<int32, 4> quad;
+                    switch (Axis) {
+                    case 0:
+                        quad = {curr(0, 0), curr(1, 0), curr(1, 1), curr(0, 1)};
+                        break;
+                    case 1:
+                        quad = {prev(1, 0), prev(1, 1), curr(1, 1), curr(1, 0)};
+                        break;
+                    default:
+                        quad = {prev(0, 1), curr(0, 1), curr(1, 1), prev(1, 1)};
+                    }
+                    if (IsInside)
+                        Swap(quad[1], quad[3]);
+
+                    auto dst = Out.Indices.GetData() + static_cast<int64>(quadID) * 6;
+                    dst[0] = quad[0];
+                    dst[1] = quad[1];
+                    dst[2] = quad[2];
+                    dst[3] = quad[0];
+                    dst[4] = quad[2];
+                    dst[5] = quad[3];
+                    ++quadID;
+                });
+            }
+        });
+
+        return !isCancelled();
+    }
+
+  private:
+    // Offsets of voxels of cells, in the numbering of AMCCActor
+    static constexpr std::array<std::array<int32, 3>, 8> Corners = {
+        {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}}};
+    // Voxels at the start and the end of edges, in the numbering of AMCCActor
+    static constexpr std::array<std::array<int32, 2>, 12> EdgeCorners = {
+        {{0, 1}, {1, 2}, {3, 2}, {0, 3}, {4, 5}, {5, 6}, {7, 6}, {4, 7},
+         {0, 4}, {1, 5}, {2, 6}, {3, 7}}};
+
+    static bool isActive(uint8 CornerState) { return CornerState != 0 && CornerState != 0xff; }
+    static uint8 getCornerState(const std::array<const uint8 *, 4> &RowInsides, int32 X) {
+        return static_cast<uint8>(RowInsides[0][X] | (RowInsides[0][X + 1] << 1) |
+                                  (RowInsides[1][X + 1] << 2) | (RowInsides[1][X] << 3) |
+                                  (RowInsides[2][X] << 4) | (RowInsides[2][X + 1] << 5) |
+                                  (RowInsides[3][X + 1] << 6) | (RowInsides[3][X] << 7));
+    }
+};
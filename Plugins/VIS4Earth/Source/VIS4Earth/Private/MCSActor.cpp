@@ -82,7 +82,7 @@ void AMCSActor::setupSignalsSlots() {
 }
 
 void AMCSActor::checkAndCorrectParameters() {
-    if (!VolumeComponent->VolumeTexture)
+    if (!VolumeComponent->HasVolume())
         return;
 
     {
@@ -94,9 +94,7 @@ void AMCSActor::checkAndCorrectParameters() {
             IsoValue = vxMax;
     }
 
-    FIntVector3 voxPerVol(VolumeComponent->VolumeTexture->GetSizeX(),
-                          VolumeComponent->VolumeTexture->GetSizeY(),
-                          VolumeComponent->VolumeTexture->GetSizeZ());
+    FIntVector3 voxPerVol = VolumeComponent->GetVoxelPerVolume();
     auto voxPerVolYxX = static_cast<size_t>(voxPerVol.Y) * voxPerVol.X;
     if (HeightRange[0] < 0)
         HeightRange[0] = 0;
@@ -1,7 +1,5 @@
 ﻿#include "MCSRenderer.h"
 
-#include <unordered_map>
-
 #include "EngineModule.h"
 #include "RenderGraphBuilder.h"
 #include "RenderGraphUtils.h"
@@ -162,22 +160,24 @@ void FMCSRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
 
 void FMCSRenderer::marchingSquare(const MCSParameters &Params,
                                   FRHICommandListImmediate &RHICmdList) {
-    if (!Params.VolumeComponent.IsValid() || !Params.VolumeComponent->VolumeTexture)
+    if (!Params.VolumeComponent.IsValid() || !Params.VolumeComponent->HasVolume())
         return;
 
-    FIntVector3 voxPerVol(Params.VolumeComponent->VolumeTexture->GetSizeX(),
-                          Params.VolumeComponent->VolumeTexture->GetSizeY(),
-                          Params.VolumeComponent->VolumeTexture->GetSizeZ());
+    FIntVector3 voxPerVol = Params.VolumeComponent->GetVoxelPerVolume();
+    auto sampler = Params.VolumeComponent->CreateVolumeSampler();
+    // Smoothing runs on the volume texture, which paged volumes do not have
+    auto useSmoothedVolume = Params.UseSmoothedVolume && !sampler.IsPaged();
+    // Skips blocks not crossed by the isolines. Without the tree, all squares are marched.
+    auto minMaxTree = useSmoothedVolume ? Params.VolumeComponent->GetVolumeMinMaxTreeSmoothed()
+                                        : Params.VolumeComponent->GetVolumeMinMaxTree();
     auto [vxMin, vxMax, vxExt] =
         VolumeData::GetVoxelMinMaxExtent(Params.VolumeComponent->GetVolumeVoxelType());
 
-    auto hashEdge = [](const FIntVector3 &edgeID) {
-        size_t hash = edgeID.X;
-        hash = (hash << 32) | edgeID.Y;
-        hash = (hash << 1) | edgeID.Z;
-        return std::hash<size_t>()(hash);
-    };
-    std::unordered_map<FIntVector3, uint32, decltype(hashEdge)> edge2vertIDs;
+    // Vertex IDs of edges on the current height, indexed by (ID.z * Y + ID.y) * X + ID.x.
+    // Vertex IDs only grow, so that slots less than firstVertID are left from lower heights.
+    TArray<int32> edgeVertIDs;
+    edgeVertIDs.Init(INDEX_NONE, 2 * voxPerVol.X * voxPerVol.Y);
+    int32 firstVertID = 0;
 
     TArray<VertexAttr> vertices;
     TArray<uint32> indices;
@@ -200,8 +200,10 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
             // ID(e1) = (startPos.xy, 1)
             FIntVector3 edgeID(startPos.X + (i == 1 ? 1 : 0), startPos.Y + (i == 2 ? 1 : 0),
                                i == 1 || i == 3 ? 1 : 0);
-            if (auto itr = edge2vertIDs.find(edgeID); itr != edge2vertIDs.end()) {
-                indices.Emplace(itr->second);
+            auto &vertID =
+                edgeVertIDs[(edgeID.Z * voxPerVol.Y + edgeID.Y) * voxPerVol.X + edgeID.X];
+            if (vertID >= firstVertID) {
+                indices.Emplace(vertID);
                 continue;
             }
 
@@ -231,7 +233,7 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
 
             indices.Emplace(vertices.Num());
             vertices.Emplace(pos, scalar);
-            edge2vertIDs.emplace(edgeID, indices.Last());
+            vertID = vertices.Num() - 1;
         }
 
         if constexpr (sizeof...(masks) >= 1)
@@ -239,11 +241,9 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
     };
     auto gen = [&]<SupportedVoxelType T>(T) {
         FIntVector3 pos;
-        for (pos.Z = Params.HeightRange[0]; pos.Z <= Params.HeightRange[1]; ++pos.Z) {
-            edge2vertIDs.clear(); // hash map only stores vertices on the same height
-
-            for (pos.Y = 0; pos.Y < voxPerVol.Y - 1; ++pos.Y)
-                for (pos.X = 0; pos.X < voxPerVol.X - 1; ++pos.X) {
+        auto marchSquares = [&](const FIntVector2 &Min, const FIntVector2 &Max) {
+            for (pos.Y = Min.Y; pos.Y < Max.Y; ++pos.Y)
+                for (pos.X = Min.X; pos.X < Max.X; ++pos.X) {
                     // Voxels in CCW order form a grid
                     // +------------+
                     // |  3 <--- 2  |
@@ -254,11 +254,10 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
                     uint8 cornerState = 0;
                     FVector4f scalars;
                     for (int32 i = 0; i < 4; ++i) {
-                        if (Params.UseSmoothedVolume) {
-                            scalars[i] = Params.VolumeComponent->SampleVolumeCPUDataSmoothed(pos);
-                            scalars[i] = scalars[i] * vxExt + vxMin; // [0, 1] -> [vxMin, vxMax]
-                        } else
-                            scalars[i] = Params.VolumeComponent->SampleVolumeCPUData<T>(pos);
+                        scalars[i] =
+                            useSmoothedVolume
+                                ? Params.VolumeComponent->SampleVolumeCPUDataSmoothed<T>(pos)
+                                : sampler.Sample<T>(pos);
                         if (scalars[i] >= Params.IsoValue)
                             cornerState |= 1 << i;
 
@@ -303,6 +302,41 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
                         break;
                     }
                 }
+        };
+
+        static constexpr int32 BlockSize = FVolumeMinMaxTree::BlockSize;
+        // Of the layer of blocks the current height lies in, which are shared by heights on it
+        TArray<FIntVector2> activeBlocks;
+        int32 activeBlockZ = INDEX_NONE;
+        for (pos.Z = Params.HeightRange[0]; pos.Z <= Params.HeightRange[1]; ++pos.Z) {
+            firstVertID = vertices.Num(); // resets edgeVertIDs without clearing its slots
+            if (auto &cache = sampler.GetBrickCache(); cache.IsValid())
+                // Read the next slice while marching through this one
+                cache->PrefetchBricks(
+                    {0, 0, pos.Z},
+                    {voxPerVol.X, voxPerVol.Y, std::min(pos.Z + 2, Params.HeightRange[1] + 1)});
+
+            if (!minMaxTree.IsValid()) {
+                marchSquares({0, 0}, {voxPerVol.X - 1, voxPerVol.Y - 1});
+                continue;
+            }
+
+            // Squares on a height lie in the blocks of cells starting on it
+            if (auto blockZ = pos.Z / BlockSize; blockZ != activeBlockZ) {
+                activeBlocks.Reset();
+                minMaxTree->ForEachActiveBlockOnLayer(
+                    Params.IsoValue, blockZ, [&](const FIntVector3 &BlockCoord) {
+                        activeBlocks.Emplace(BlockCoord.X, BlockCoord.Y);
+                    });
+                activeBlocks.Sort([](const FIntVector2 &A, const FIntVector2 &B) {
+                    return A.Y < B.Y || (A.Y == B.Y && A.X < B.X);
+                });
+                activeBlockZ = blockZ;
+            }
+            for (auto &block : activeBlocks)
+                marchSquares(block * BlockSize,
+                             {std::min((block.X + 1) * BlockSize, voxPerVol.X - 1),
+                              std::min((block.Y + 1) * BlockSize, voxPerVol.Y - 1)});
         }
     };
 
@@ -311,6 +345,11 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
         gen(uint8(0));
         break;
     }
+    // Voxels of bricks failing to load read as 0, which must not make up the isolines
+    if (auto errMsg = sampler.GetLoadError(); errMsg.IsSet()) {
+        UE_LOG(LogStats, Error, TEXT("%s"), **errMsg);
+        indices.Reset();
+    }
     if (indices.IsEmpty()) {
         vertNum = primNum = 0;
         return;
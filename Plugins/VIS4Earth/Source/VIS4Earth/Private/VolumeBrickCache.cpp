@@ -0,0 +1,200 @@
+// Author: Kouek Kou
+
+#include "VolumeBrickCache.h"
+
+#include "Async/Async.h"
+#include "Misc/ScopeLock.h"
+
+#include "VolumeTransposer.h"
+
+TVariant<TSharedRef<FVolumeBrickCache>, FString>
+FVolumeBrickCache::Create(const Parameters &Params) {
+    using RetType = TVariant<TSharedRef<FVolumeBrickCache>, FString>;
+
+    auto params = Params;
+    params.Desc.ROIMin = VolumeData::LoadFromFileDesc::DefROIMin;
+    params.Desc.ROIStride = VolumeData::LoadFromFileDesc::DefROIStride;
+
+    // Opened once, so that bricks neither reopen nor remap the file
+    auto fileRet = VolumeData::OpenFile(params.Desc.FilePath);
+    if (fileRet.IsType<FString>())
+        return RetType(TInPlaceType<FString>(), fileRet.Get<FString>());
+    auto &opened = fileRet.Get<TSharedRef<const VolumeData::OpenedFile>>();
+    if (opened->ContainerHeader.IsSet())
+        params.BrickSize = opened->ContainerHeader->BrickSize;
+    if (params.BrickSize <= 0)
+        return RetType(TInPlaceType<FString>(),
+                       FString::Format(TEXT("Invalid Params.BrickSize {0}."), {params.BrickSize}));
+
+    // Probe the first voxel, so that an invalid description fails here instead of in every brick
+    {
+        auto probeDesc = params.Desc;
+        probeDesc.ROIMax = FIntVector3(1, 1, 1);
+        VolumeCPUData probe;
+        auto ret = VolumeData::LoadCPUDataFromFile(probeDesc, *opened, probe);
+        if (ret.IsType<FString>())
+            return RetType(TInPlaceType<FString>(), ret.Get<FString>());
+    }
+
+    return RetType(TInPlaceType<TSharedRef<FVolumeBrickCache>>(),
+                   MakeShareable(new FVolumeBrickCache(
+                       params,
+                       FVolumeTransposer::GetTransposedDimension(params.Desc.Axis,
+                                                                 params.Desc.Dimension),
+                       opened)));
+}
+
+FVolumeBrickCache::FVolumeBrickCache(const Parameters &Params, const FIntVector3 &Dimension,
+                                     const TSharedRef<const VolumeData::OpenedFile> &File)
+    : brickSize(Params.BrickSize), memoryBudget(Params.MemoryBudget), dimension(Dimension),
+      brickNum(FMath::DivideAndRoundUp(Dimension.X, Params.BrickSize),
+               FMath::DivideAndRoundUp(Dimension.Y, Params.BrickSize),
+               FMath::DivideAndRoundUp(Dimension.Z, Params.BrickSize)),
+      desc(Params.Desc), file(File) {}
+
+int64 FVolumeBrickCache::GetResidentSize() const {
+    FScopeLock lock(&mutex);
+    return residentSize;
+}
+
+TOptional<FString> FVolumeBrickCache::GetLoadError() const {
+    FScopeLock lock(&mutex);
+    return loadError;
+}
+
+TSharedPtr<const VolumeCPUData> FVolumeBrickCache::FetchBrick(const FIntVector3 &BrickCoord) {
+    auto [future, promise] = acquire(BrickCoord);
+    if (promise.IsValid())
+        load(BrickCoord, *promise);
+
+    return future.Get();
+}
+
+void FVolumeBrickCache::PrefetchBricks(const FIntVector3 &VoxelMin, const FIntVector3 &VoxelMax) {
+    FIntVector3 minCoord, maxCoord;
+    for (int32 i = 0; i < 3; ++i) {
+        minCoord[i] = std::max(0, VoxelMin[i] / brickSize);
+        maxCoord[i] = std::min(brickNum[i], FMath::DivideAndRoundUp(VoxelMax[i], brickSize));
+    }
+
+    FIntVector3 brickCoord;
+    for (brickCoord.Z = minCoord.Z; brickCoord.Z < maxCoord.Z; ++brickCoord.Z)
+        for (brickCoord.Y = minCoord.Y; brickCoord.Y < maxCoord.Y; ++brickCoord.Y)
+            for (brickCoord.X = minCoord.X; brickCoord.X < maxCoord.X; ++brickCoord.X) {
+                if (!enqueue(brickCoord))
+                    continue;
+
+                // The brick may have been claimed by a fetch before the task runs
+                Async(EAsyncExecution::ThreadPool, [cache = AsShared(), brickCoord]() {
+                    if (auto promise = cache->claim(brickCoord); promise.IsValid())
+                        cache->load(brickCoord, *promise);
+                });
+            }
+}
+
+TTuple<FVolumeBrickCache::BrickFuture, TSharedPtr<FVolumeBrickCache::BrickPromise>>
+FVolumeBrickCache::acquire(const FIntVector3 &BrickCoord) {
+    FScopeLock lock(&mutex);
+
+    auto brickIdx = getBrickIndex(BrickCoord);
+    if (auto entry = entries.Find(brickIdx); entry) {
+        // Bricks still loading are not resident yet
+        if (entry->Size != 0) {
+            unlink(*entry);
+            linkAsMostRecentlyUsed(brickIdx, *entry);
+        }
+        // Waiting for a queued prefetch could block this thread of the pool on tasks behind it
+        return MakeTuple(entry->Brick, MoveTemp(entry->QueuedPromise));
+    }
+
+    // Register the brick before loading it, so that concurrent requests wait for the same load
+    auto promise = MakeShared<BrickPromise>();
+    auto &entry = entries.Emplace(brickIdx);
+    entry.Brick = promise->GetFuture().Share();
+    return MakeTuple(entry.Brick, promise);
+}
+
+bool FVolumeBrickCache::enqueue(const FIntVector3 &BrickCoord) {
+    FScopeLock lock(&mutex);
+
+    auto brickIdx = getBrickIndex(BrickCoord);
+    if (entries.Contains(brickIdx))
+        return false;
+
+    auto &entry = entries.Emplace(brickIdx);
+    entry.QueuedPromise = MakeShared<BrickPromise>();
+    entry.Brick = entry.QueuedPromise->GetFuture().Share();
+    return true;
+}
+
+TSharedPtr<FVolumeBrickCache::BrickPromise>
+FVolumeBrickCache::claim(const FIntVector3 &BrickCoord) {
+    FScopeLock lock(&mutex);
+
+    auto entry = entries.Find(getBrickIndex(BrickCoord));
+    return entry ? MoveTemp(entry->QueuedPromise) : TSharedPtr<BrickPromise>();
+}
+
+void FVolumeBrickCache::load(const FIntVector3 &BrickCoord, BrickPromise &Promise) {
+    auto [min, max] = GetBrickVoxelRange(BrickCoord);
+    auto brickDesc = desc;
+    brickDesc.ROIMin = min;
+    brickDesc.ROIMax = max;
+
+    TSharedPtr<VolumeCPUData> brick = MakeShared<VolumeCPUData>();
+    auto ret = VolumeData::LoadCPUDataFromFile(brickDesc, *file, *brick);
+    if (ret.IsType<FString>())
+        // Failed bricks stay registered as nullptr, instead of being retried on every sample
+        brick.Reset();
+
+    {
+        FScopeLock lock(&mutex);
+
+        if (!brick.IsValid() && !loadError.IsSet())
+            loadError = FString::Format(TEXT("Failed to load brick {0} of {1}: {2}"),
+                                        {BrickCoord.ToString(), desc.FilePath.FilePath,
+                                         ret.Get<FString>()});
+
+        auto brickIdx = getBrickIndex(BrickCoord);
+        if (auto entry = entries.Find(brickIdx); entry && brick.IsValid()) {
+            entry->Size = brick->Num();
+            residentSize += entry->Size;
+            linkAsMostRecentlyUsed(brickIdx, *entry);
+            evict(brickIdx);
+        }
+    }
+
+    Promise.SetValue(MoveTemp(brick));
+}
+
+void FVolumeBrickCache::evict(int32 KeptBrickIndex) {
+    while (residentSize > memoryBudget && lruHead != INDEX_NONE && lruHead != KeptBrickIndex) {
+        auto lruIdx = lruHead;
+        auto &entry = entries.FindChecked(lruIdx);
+        residentSize -= entry.Size;
+        unlink(entry);
+        entries.Remove(lruIdx);
+    }
+}
+
+void FVolumeBrickCache::linkAsMostRecentlyUsed(int32 BrickIndex, Entry &BrickEntry) {
+    BrickEntry.Prev = lruTail;
+    BrickEntry.Next = INDEX_NONE;
+    if (lruTail != INDEX_NONE)
+        entries.FindChecked(lruTail).Next = BrickIndex;
+    else
+        lruHead = BrickIndex;
+    lruTail = BrickIndex;
+}
+
+void FVolumeBrickCache::unlink(Entry &BrickEntry) {
+    if (BrickEntry.Prev != INDEX_NONE)
+        entries.FindChecked(BrickEntry.Prev).Next = BrickEntry.Next;
+    else
+        lruHead = BrickEntry.Next;
+    if (BrickEntry.Next != INDEX_NONE)
+        entries.FindChecked(BrickEntry.Next).Prev = BrickEntry.Prev;
+    else
+        lruTail = BrickEntry.Prev;
+    BrickEntry.Prev = BrickEntry.Next = INDEX_NONE;
+}
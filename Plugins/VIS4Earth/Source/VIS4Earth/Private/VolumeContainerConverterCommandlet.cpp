@@ -0,0 +1,84 @@
+#include "VolumeContainerConverterCommandlet.h"
+
+#include "Data.h"
+
+template <typename T>
+static bool parseComponents(const TMap<FString, FString> &Params, const TCHAR *Key, T &Val,
+                            int32 Num) {
+    auto str = Params.Find(Key);
+    if (!str)
+        return true;
+
+    TArray<FString> parts;
+    if (str->ParseIntoArray(parts, TEXT(",")) != Num)
+        return false;
+    for (int32 i = 0; i < Num; ++i)
+        if constexpr (std::is_integral_v<std::remove_reference_t<decltype(Val[0])>>)
+            Val[i] = FCString::Atoi(*parts[i]);
+        else
+            Val[i] = FCString::Atod(*parts[i]);
+    return true;
+}
+
+UVolumeContainerConverterCommandlet::UVolumeContainerConverterCommandlet() {
+    IsClient = false;
+    IsServer = false;
+    IsEditor = false;
+    LogToConsole = true;
+}
+
+int32 UVolumeContainerConverterCommandlet::Main(const FString &Params) {
+    TArray<FString> tokens, switches;
+    TMap<FString, FString> params;
+    ParseCommandLine(*Params, tokens, switches, params);
+
+    auto src = params.Find(TEXT("Src"));
+    auto dst = params.Find(TEXT("Dst"));
+    auto voxTy = params.Find(TEXT("VoxTy"));
+    if (!src || !dst || !voxTy) {
+        UE_LOG(LogTemp, Error, TEXT("-Src, -Dst and -VoxTy are required."));
+        return 1;
+    }
+
+    VolumeData::LoadFromFileDesc loadDesc;
+    VolumeContainerHeader header;
+    loadDesc.FilePath.FilePath = *src;
+    if (auto val = StaticEnum<ESupportedVoxelType>()->GetValueByNameString(*voxTy);
+        val != INDEX_NONE)
+        loadDesc.VoxTy = static_cast<ESupportedVoxelType>(val);
+    else {
+        UE_LOG(LogTemp, Error, TEXT("Unknown -VoxTy %s."), **voxTy);
+        return 1;
+    }
+    if (!parseComponents(params, TEXT("Dim"), loadDesc.Dimension, 3) ||
+        !parseComponents(params, TEXT("Axis"), loadDesc.Axis, 3) ||
+        !parseComponents(params, TEXT("Lon"), header.LongtitudeRange, 2) ||
+        !parseComponents(params, TEXT("Lat"), header.LatitudeRange, 2) ||
+        !parseComponents(params, TEXT("Height"), header.HeightRange, 2)) {
+        UE_LOG(LogTemp, Error, TEXT("-Dim and -Axis need 3 components, others need 2."));
+        return 1;
+    }
+    if (auto val = params.Find(TEXT("BrickSize")))
+        header.BrickSize = FCString::Atoi(**val);
+    if (auto val = params.Find(TEXT("Compression")))
+        header.CompressionFormat = FName(*val);
+
+    VolumeCPUData volDat;
+    auto ret = VolumeData::LoadCPUDataFromFile(loadDesc, volDat);
+    if (ret.IsType<FString>()) {
+        UE_LOG(LogTemp, Error, TEXT("%s"), *ret.Get<FString>());
+        return 1;
+    }
+
+    header.VoxTy = loadDesc.VoxTy;
+    header.Axis = loadDesc.Axis;
+    header.Dimension = ret.Get<FIntVector3>();
+    if (auto errMsg = VolumeData::SaveCPUDataToContainer(volDat, header, {*dst});
+        errMsg.IsSet()) {
+        UE_LOG(LogTemp, Error, TEXT("%s"), **errMsg);
+        return 1;
+    }
+
+    UE_LOG(LogTemp, Display, TEXT("Converted %s into %s."), **src, **dst);
+    return 0;
+}
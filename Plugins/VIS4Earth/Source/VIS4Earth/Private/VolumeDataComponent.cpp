@@ -3,13 +3,17 @@
 #include <array>
 #include <map>
 
+#include "Async/Async.h"
 #include "Components/Button.h"
 #include "Components/ComboBoxString.h"
 #include "Components/EditableText.h"
 #include "DesktopPlatformModule.h"
 #include "Framework/Notifications/NotificationManager.h"
+#include "HAL/FileManager.h"
+#include "Misc/App.h"
 #include "Widgets/Notifications/SNotificationList.h"
 
+#include "GeoComponent.h"
 #include "VolumeSmoother.h"
 
 struct VolumeDataComponentNamesInUI {
@@ -79,31 +83,433 @@ void UVolumeDataComponent::LoadRAWVolume() {
     FDesktopPlatformModule::Get()->OpenFileDialog(
         FSlateApplication::Get().FindBestParentWindowHandleForDialogs(nullptr),
         TEXT("Select a RAW Volume file"), FPaths::GetProjectFilePath(), TEXT(""),
-        TEXT("Volume|*.raw;*.bin;*.RAW"), EFileDialogFlags::None, files);
+        TEXT("Volume|*.raw;*.bin;*.RAW;*.v4ev"), EFileDialogFlags::None, files);
     if (files.IsEmpty())
         return;
 
-    auto volume = keepVolumeInCPU ? VolumeData::LoadFromFile({.VoxTy = ImportVoxelType,
-                                                              .Axis = ImportVolumeTransformedAxis,
-                                                              .Dimension = ImportVolumeDimension,
-                                                              .FilePath = {files[0]}},
-                                                             std::reference_wrapper(volumeCPUData))
-                                  : VolumeData::LoadFromFile({.VoxTy = ImportVoxelType,
-                                                              .Axis = ImportVolumeTransformedAxis,
-                                                              .Dimension = ImportVolumeDimension,
-                                                              .FilePath = {files[0]}});
-    if (volume.IsType<FString>()) {
-        auto &errMsg = volume.Get<FString>();
-        processError(errMsg);
+    if (auto desc = makeImportDesc(files[0]); desc.IsSet())
+        importRAWVolume(*desc);
+}
+
+void UVolumeDataComponent::LoadTimeSeries() {
+    TArray<FString> files;
+    if (!TimeSeriesFilePattern.IsEmpty()) {
+        IFileManager::Get().FindFiles(files, *TimeSeriesFilePattern, true, false);
+        if (files.IsEmpty()) {
+            processError(FString::Format(TEXT("No file matches TimeSeriesFilePattern {0}."),
+                                         {TimeSeriesFilePattern}));
+            return;
+        }
+        for (auto &file : files)
+            file = FPaths::Combine(FPaths::GetPath(TimeSeriesFilePattern), file);
+    } else {
+        FDesktopPlatformModule::Get()->OpenFileDialog(
+            FSlateApplication::Get().FindBestParentWindowHandleForDialogs(nullptr),
+            TEXT("Select RAW Volume files of all time steps"), FPaths::GetProjectFilePath(),
+            TEXT(""), TEXT("Volume|*.raw;*.bin;*.RAW;*.v4ev"), EFileDialogFlags::Multiple, files);
+        if (files.IsEmpty())
+            return;
+    }
+
+    // Time steps are ordered by file names, e.g. T_000.raw, T_006.raw, ...
+    files.Sort();
+    SetTimeSeries(files);
+}
+
+TOptional<VolumeData::LoadFromFileDesc>
+UVolumeDataComponent::makeImportDesc(const FString &FilePath) {
+    // Built locally, so that importing leaves the settings for RAW volumes as they are
+    VolumeData::LoadFromFileDesc desc{.VoxTy = ImportVoxelType,
+                                      .Axis = ImportVolumeTransformedAxis,
+                                      .Dimension = ImportVolumeDimension,
+                                      .ROIMin = ImportROIMin,
+                                      .ROIMax = ImportROIMax,
+                                      .ROIStride = ImportROIStride,
+                                      .FilePath = {FilePath}};
+    auto lonRng = ImportVolumeLongtitudeRange;
+    auto latRng = ImportVolumeLatitudeRange;
+    auto hRng = ImportVolumeHeightRange;
+
+    if (VolumeData::IsContainerFile(FilePath)) {
+        // Containers describe themselves and are already transposed
+        auto ret = VolumeData::LoadContainerHeaderFromFile({FilePath});
+        if (ret.IsType<FString>()) {
+            processError(ret.Get<FString>());
+            return {};
+        }
+
+        auto &header = ret.Get<VolumeContainerHeader>();
+        desc.VoxTy = header.VoxTy;
+        desc.Dimension = header.Dimension;
+        desc.Axis = {1, 2, 3};
+        if (header.LongtitudeRange[0] < header.LongtitudeRange[1] &&
+            header.LatitudeRange[0] < header.LatitudeRange[1] &&
+            header.HeightRange[0] < header.HeightRange[1]) {
+            lonRng = header.LongtitudeRange;
+            latRng = header.LatitudeRange;
+            hRng = header.HeightRange;
+        }
+    }
+
+    auto isAxisValid = [&]() {
+        for (int32 i = 0; i < 3; ++i)
+            if (auto j = std::abs(desc.Axis[i]); j < 1 || j > 3)
+                return false;
+        return true;
+    };
+    if (DeriveImportROIFromGeographics && isAxisValid())
+        if (auto geoCmpt = GetOwner() ? GetOwner()->FindComponentByClass<UGeoComponent>() : nullptr;
+            geoCmpt) {
+            auto [roiMin, roiMax] = geoCmpt->GetVoxelROI(
+                lonRng, latRng, hRng,
+                FIntVector3(desc.Dimension[std::abs(desc.Axis[0]) - 1],
+                            desc.Dimension[std::abs(desc.Axis[1]) - 1],
+                            desc.Dimension[std::abs(desc.Axis[2]) - 1]));
+            desc.ROIMin = roiMin;
+            desc.ROIMax = roiMax;
+        }
+
+    return desc;
+}
+
+void UVolumeDataComponent::CancelVolumeImport() {
+    if (importState.IsValid())
+        importState->Cancelled = true;
+    endVolumeImport();
+}
+
+void UVolumeDataComponent::endVolumeImport() {
+    importState.Reset();
+    if (importProgressTicker.IsValid()) {
+        FTSTicker::GetCoreTicker().RemoveTicker(importProgressTicker);
+        importProgressTicker.Reset();
+    }
+}
+
+void UVolumeDataComponent::importRAWVolume(const VolumeData::LoadFromFileDesc &Desc) {
+    // Picking another file supersedes the one being imported, or the time series being played
+    CancelVolumeImport();
+    clearTimeSeries();
+    if (PageVolume) {
+        pageVolume(Desc);
         return;
     }
 
-    VolumeTexture = volume.Get<UVolumeTexture *>();
-    voxPerVolYxX = static_cast<size_t>(ImportVolumeDimension.X) * ImportVolumeDimension.Y;
-    prevVolumeDataDesc.VoxTy = ImportVoxelType;
-    prevVolumeDataDesc.Dimension = ImportVolumeDimension;
+    auto state = MakeShared<VolumeData::LoadFromFileState>();
+    importState = state;
+    importProgressTicker = FTSTicker::GetCoreTicker().AddTicker(
+        FTickerDelegate::CreateWeakLambda(this,
+                                          [this, state](float) {
+                                              OnVolumeImportProgressed.Broadcast(
+                                                  this, state->Progress.load());
+                                              return true;
+                                          }),
+        .1f);
+
+    // Stage 1 (worker thread): I/O, transposition and deriving trees, gradients and smoothed voxels
+    Async(EAsyncExecution::ThreadPool, [weakThis = TWeakObjectPtr<UVolumeDataComponent>(this),
+                                        state, Desc,
+                                        params = makeDeriveParameters(Desc.VoxTy, {})]() mutable {
+        auto volDat = MakeShared<VolumeCPUData>();
+        auto ret = VolumeData::LoadCPUDataFromFile(Desc, *volDat, state.Get());
+
+        DerivedVolumeData derived, derivedSmoothed;
+        if (ret.IsType<FIntVector3>() && !state->Cancelled) {
+            params.Dimension = ret.Get<FIntVector3>();
+            derived = deriveVolumeData(params, volDat);
+            // Failures are reported when smoothing again on the game thread
+            if (params.KeepSmoothedVolume && params.SmoothOnCPU)
+                if (auto smoothed = deriveSmoothedVolumeData(params, *volDat);
+                    smoothed.IsType<DerivedVolumeData>())
+                    derivedSmoothed = smoothed.Get<DerivedVolumeData>();
+        }
 
-    generateSmoothedVolume();
+        // Stage 2 (game thread): texture staging and broadcasting
+        AsyncTask(ENamedThreads::GameThread,
+                  [weakThis, state, Desc, ret, params, derived, derivedSmoothed]() {
+                      if (!weakThis.IsValid() || state->Cancelled ||
+                          weakThis->importState != state)
+                          return;
+
+                      weakThis->endVolumeImport();
+                      if (ret.IsType<FString>()) {
+                          processError(ret.Get<FString>());
+                          return;
+                      }
+                      weakThis->onRAWVolumeImported(Desc, params, derived, derivedSmoothed);
+                  });
+    });
+}
+
+void UVolumeDataComponent::pageVolume(const VolumeData::LoadFromFileDesc &Desc) {
+    auto ret = FVolumeBrickCache::Create(
+        {.BrickSize = PagedBrickSize,
+         .MemoryBudget = static_cast<int64>(PagedMemoryBudgetMB) << 20,
+         .Desc = Desc});
+    if (ret.IsType<FString>()) {
+        processError(ret.Get<FString>());
+        return;
+    }
+
+    volumeBrickCache = ret.Get<TSharedRef<FVolumeBrickCache>>();
+    ++smoothGeneration;
+    VolumeTexture = nullptr;
+    VolumeTextureSmoothed = nullptr;
+    volumeCPUData.Reset();
+    volumeCPUDataSmoothed.Reset();
+    volumeMinMaxTree.Reset();
+    volumeMinMaxTreeSmoothed.Reset();
+    volumeGradient.Reset();
+    volumeGradientSmoothed.Reset();
+
+    prevVolumeDataDesc.VoxTy = Desc.VoxTy;
+    prevVolumeDataDesc.Dimension = volumeBrickCache->GetDimension();
+    voxPerVolYxX = static_cast<size_t>(prevVolumeDataDesc.Dimension.X) *
+                   prevVolumeDataDesc.Dimension.Y;
+
+    OnVolumeDataChanged.Broadcast(this);
+}
+
+void UVolumeDataComponent::onRAWVolumeImported(const VolumeData::LoadFromFileDesc &Desc,
+                                               const DeriveParameters &Params,
+                                               const DerivedVolumeData &Derived,
+                                               const DerivedVolumeData &DerivedSmoothed) {
+    volumeBrickCache.Reset();
+    VolumeTexture = VolumeData::CreateTextureFromCPUData(*Derived.CPUData, Desc.VoxTy,
+                                                         Params.Dimension, Desc.Name);
+
+    prevVolumeDataDesc.VoxTy = Desc.VoxTy;
+    prevVolumeDataDesc.Dimension = Params.Dimension;
+    voxPerVolYxX = static_cast<size_t>(Params.Dimension.X) * Params.Dimension.Y;
+    applyDerivedVolumeData(Derived);
+
+    OnVolumeImportProgressed.Broadcast(this, 1.f);
+
+    takeOrGenerateSmoothedVolume(
+        Params,
+        DerivedSmoothed.CPUData.IsValid()
+            ? VolumeData::CreateTextureFromCPUData(*DerivedSmoothed.CPUData, Desc.VoxTy,
+                                                   Params.Dimension)
+            : nullptr,
+        DerivedSmoothed);
+
+    OnVolumeDataChanged.Broadcast(this);
+}
+
+void UVolumeDataComponent::SetTimeSeries(const TArray<FString> &FilePaths) {
+    CancelVolumeImport();
+    clearTimeSeries();
+    if (FilePaths.IsEmpty())
+        return;
+
+    auto desc = makeImportDesc(FilePaths[0]);
+    if (!desc.IsSet())
+        return;
+
+    volumeBrickCache.Reset();
+    timeSeriesDesc = *desc;
+    timeSeriesFiles = FilePaths;
+    timeStepSlots.SetNum(std::max(TimeSeriesPrefetchDepth, 0) + 1);
+    TimeSeriesTextures.Init(nullptr, timeStepSlots.Num());
+    TimeSeriesTexturesSmoothed.Init(nullptr, timeStepSlots.Num());
+    timeStepLoadLatencies.Init(-1., timeSeriesFiles.Num());
+    failedTimeSteps.Init(false, timeSeriesFiles.Num());
+
+    SetTimeStep(0);
+}
+
+void UVolumeDataComponent::SetTimeStep(int32 Step) {
+    if (timeSeriesFiles.IsEmpty())
+        return;
+
+    auto stepNum = timeSeriesFiles.Num();
+    pendingTimeStep = (Step % stepNum + stepNum) % stepNum;
+    prefetchTimeSteps();
+
+    if (auto slotIdx = timeStepSlots.IndexOfByPredicate([&](const TimeStepSlot &Slot) {
+            return Slot.Step == pendingTimeStep && Slot.Ready;
+        });
+        slotIdx != INDEX_NONE)
+        showTimeStep(slotIdx);
+}
+
+void UVolumeDataComponent::PlayTimeSeries() {
+    PauseTimeSeries();
+    if (timeSeriesFiles.IsEmpty() || TimeSeriesStepsPerSecond <= 0.f)
+        return;
+
+    timeSeriesPlaybackTicker = FTSTicker::GetCoreTicker().AddTicker(
+        FTickerDelegate::CreateWeakLambda(this,
+                                          [this](float) {
+                                              // Hold the current step while the next one is
+                                              // still loading, and pass over failed ones
+                                              if (pendingTimeStep == timeStep ||
+                                                  failedTimeSteps[pendingTimeStep])
+                                                  SetTimeStep(pendingTimeStep + 1);
+                                              return true;
+                                          }),
+        1.f / TimeSeriesStepsPerSecond);
+}
+
+void UVolumeDataComponent::PauseTimeSeries() {
+    if (!timeSeriesPlaybackTicker.IsValid())
+        return;
+
+    FTSTicker::GetCoreTicker().RemoveTicker(timeSeriesPlaybackTicker);
+    timeSeriesPlaybackTicker.Reset();
+}
+
+double UVolumeDataComponent::GetAverageTimeStepLoadLatency() const {
+    double sum = 0.;
+    int32 num = 0;
+    for (auto latency : timeStepLoadLatencies)
+        if (latency >= 0.) {
+            sum += latency;
+            ++num;
+        }
+
+    return num == 0 ? -1. : sum / num;
+}
+
+void UVolumeDataComponent::clearTimeSeries() {
+    PauseTimeSeries();
+    for (auto &slot : timeStepSlots)
+        if (slot.State.IsValid())
+            slot.State->Cancelled = true;
+
+    timeSeriesFiles.Empty();
+    timeStepSlots.Empty();
+    TimeSeriesTextures.Empty();
+    TimeSeriesTexturesSmoothed.Empty();
+    timeStepLoadLatencies.Empty();
+    failedTimeSteps.Empty();
+    timeStep = pendingTimeStep = -1;
+    shownTimeStepSlotIdx = INDEX_NONE;
+}
+
+void UVolumeDataComponent::prefetchTimeSteps() {
+    auto stepNum = timeSeriesFiles.Num();
+    auto windowSz = std::min(timeStepSlots.Num(), stepNum);
+    auto isInWindow = [&](int32 step) {
+        return step >= 0 && (step - pendingTimeStep + stepNum) % stepNum < windowSz;
+    };
+
+    // Steps nearer to the pending one are requested first
+    for (int32 i = 0; i < windowSz; ++i) {
+        auto step = (pendingTimeStep + i) % stepNum;
+        if (failedTimeSteps[step] ||
+            timeStepSlots.ContainsByPredicate(
+                [&](const TimeStepSlot &Slot) { return Slot.Step == step; }))
+            continue;
+
+        // Always found, since the window is no larger than the ring buffer
+        auto slotIdx = timeStepSlots.IndexOfByPredicate(
+            [&](const TimeStepSlot &Slot) { return !isInWindow(Slot.Step); });
+        loadTimeStep(slotIdx, step);
+    }
+}
+
+void UVolumeDataComponent::loadTimeStep(int32 SlotIdx, int32 Step) {
+    auto &slot = timeStepSlots[SlotIdx];
+    if (slot.State.IsValid())
+        slot.State->Cancelled = true;
+
+    auto state = MakeShared<VolumeData::LoadFromFileState>();
+    slot.Step = Step;
+    slot.Ready = false;
+    slot.State = state;
+    slot.Derived = {};
+    slot.DerivedSmoothed = {};
+    TimeSeriesTextures[SlotIdx] = nullptr;
+    TimeSeriesTexturesSmoothed[SlotIdx] = nullptr;
+
+    auto desc = timeSeriesDesc;
+    desc.FilePath.FilePath = timeSeriesFiles[Step];
+    Async(EAsyncExecution::ThreadPool,
+          [weakThis = TWeakObjectPtr<UVolumeDataComponent>(this), state, desc, SlotIdx,
+           params = makeDeriveParameters(desc.VoxTy, {})]() mutable {
+              auto startTime = FPlatformTime::Seconds();
+              auto volDat = MakeShared<VolumeCPUData>();
+              auto ret = VolumeData::LoadCPUDataFromFile(desc, *volDat, state.Get());
+
+              // Trees, gradients and smoothed voxels of the step are derived here too
+              DerivedVolumeData derived, derivedSmoothed;
+              if (ret.IsType<FIntVector3>() && !state->Cancelled) {
+                  params.Dimension = ret.Get<FIntVector3>();
+                  derived = deriveVolumeData(params, volDat);
+                  // Failures are reported when smoothing again on the game thread
+                  if (params.KeepSmoothedVolume && params.SmoothOnCPU)
+                      if (auto smoothed = deriveSmoothedVolumeData(params, *volDat);
+                          smoothed.IsType<DerivedVolumeData>())
+                          derivedSmoothed = smoothed.Get<DerivedVolumeData>();
+              }
+
+              AsyncTask(ENamedThreads::GameThread, [weakThis, state, SlotIdx, ret, params,
+                                                    derived, derivedSmoothed, startTime]() {
+                  if (!weakThis.IsValid() || state->Cancelled)
+                      return;
+
+                  weakThis->onTimeStepLoaded(SlotIdx, state, ret, params, derived,
+                                             derivedSmoothed, startTime);
+              });
+          });
+}
+
+void UVolumeDataComponent::onTimeStepLoaded(
+    int32 SlotIdx, const TSharedPtr<VolumeData::LoadFromFileState> &State,
+    const TVariant<FIntVector3, FString> &Ret, const DeriveParameters &Params,
+    const DerivedVolumeData &Derived, const DerivedVolumeData &DerivedSmoothed,
+    double StartTime) {
+    if (!timeStepSlots.IsValidIndex(SlotIdx) || timeStepSlots[SlotIdx].State != State)
+        return;
+
+    auto &slot = timeStepSlots[SlotIdx];
+    slot.State.Reset();
+    if (Ret.IsType<FString>()) {
+        processError(Ret.Get<FString>());
+        // The slot is freed for other steps, instead of holding the failed one forever
+        failedTimeSteps[slot.Step] = true;
+        slot.Step = -1;
+        return;
+    }
+
+    // Staged as soon as the step arrives, so that showing it later only swaps the textures
+    slot.Dimension = Ret.Get<FIntVector3>();
+    TimeSeriesTextures[SlotIdx] = VolumeData::CreateTextureFromCPUData(
+        *Derived.CPUData, timeSeriesDesc.VoxTy, slot.Dimension);
+    if (DerivedSmoothed.CPUData.IsValid())
+        TimeSeriesTexturesSmoothed[SlotIdx] = VolumeData::CreateTextureFromCPUData(
+            *DerivedSmoothed.CPUData, timeSeriesDesc.VoxTy, slot.Dimension);
+    slot.Params = Params;
+    slot.Derived = Derived;
+    if (!Params.KeepVolumeInCPU)
+        slot.Derived.CPUData.Reset();
+    slot.DerivedSmoothed = DerivedSmoothed;
+    slot.Ready = true;
+
+    auto latency = FPlatformTime::Seconds() - StartTime;
+    timeStepLoadLatencies[slot.Step] = latency;
+    OnTimeStepLoaded.Broadcast(this, slot.Step, latency);
+
+    if (slot.Step == pendingTimeStep)
+        showTimeStep(SlotIdx);
+}
+
+void UVolumeDataComponent::showTimeStep(int32 SlotIdx) {
+    auto &slot = timeStepSlots[SlotIdx];
+
+    VolumeTexture = TimeSeriesTextures[SlotIdx];
+    timeStep = slot.Step;
+    shownTimeStepSlotIdx = SlotIdx;
+
+    prevVolumeDataDesc.VoxTy = timeSeriesDesc.VoxTy;
+    prevVolumeDataDesc.Dimension = slot.Dimension;
+    voxPerVolYxX = static_cast<size_t>(slot.Dimension.X) * slot.Dimension.Y;
+    // Shared with its slot, so that stepping back needs no reload
+    applyDerivedVolumeData(slot.Derived);
+
+    takeOrGenerateSmoothedVolume(slot.Params, TimeSeriesTexturesSmoothed[SlotIdx],
+                                 slot.DerivedSmoothed);
 
     OnVolumeDataChanged.Broadcast(this);
 }
@@ -215,6 +621,7 @@ void UVolumeDataComponent::BeginPlay() {
 }
 
 void UVolumeDataComponent::generateSmoothedVolume() {
+    ++smoothGeneration;
     if (!VolumeTexture)
         return;
     if (!keepSmoothedVolume) {
@@ -222,29 +629,182 @@ void UVolumeDataComponent::generateSmoothedVolume() {
         return;
     }
 
+    // Smoothed from the texture, whose dimension is the one of the results
+    auto params = makeDeriveParameters(prevVolumeDataDesc.VoxTy,
+                                       FIntVector3(VolumeTexture->GetSizeX(),
+                                                   VolumeTexture->GetSizeY(),
+                                                   VolumeTexture->GetSizeZ()));
+    // Derived on workers, and dropped if superseded before arriving at the game thread
+    auto deriveInBackground =
+        [weakThis = TWeakObjectPtr<UVolumeDataComponent>(this), generation = smoothGeneration,
+         params](TUniqueFunction<TVariant<DerivedVolumeData, FString>()> Derive) {
+            Async(EAsyncExecution::ThreadPool, [weakThis, generation, params,
+                                                Derive = MoveTemp(Derive)]() {
+                auto ret = Derive();
+                AsyncTask(ENamedThreads::GameThread, [weakThis, generation, params, ret]() {
+                    if (weakThis.IsValid() && weakThis->smoothGeneration == generation)
+                        weakThis->onVolumeSmoothed(params, ret);
+                });
+            });
+        };
+
+    if (params.SmoothOnCPU) {
+        if (!volumeCPUData.IsValid())
+            return;
+
+        deriveInBackground([params, volDat = volumeCPUData]() {
+            return deriveSmoothedVolumeData(params, *volDat);
+        });
+        return;
+    }
+    // Without a renderer, e.g. on dedicated servers, only voxels kept in CPU are smoothed
+    if (!FApp::CanEverRender())
+        return;
+
     FVolumeSmoother::Exec(
         {.SmoothType = VolumeSmoothType,
          .SmoothDimension = VolumeSmoothDimension,
+         .Radius = VolumeSmoothRadius,
+         .VoxelType = prevVolumeDataDesc.VoxTy,
          .VolumeTexture = VolumeTexture,
-         .FinishedCallback = [this](TSharedPtr<TArray<float>> VolDat) {
-             VolumeTextureSmoothed = UVolumeTexture::CreateTransient(
-                 VolumeTexture->GetSizeX(), VolumeTexture->GetSizeY(), VolumeTexture->GetSizeZ(),
-                 EPixelFormat::PF_R32_FLOAT);
-             VolumeTextureSmoothed->Filter = TextureFilter::TF_Trilinear;
-             VolumeTextureSmoothed->AddressMode = TextureAddress::TA_Clamp;
+         .FinishedCallback = [weakThis = TWeakObjectPtr<UVolumeDataComponent>(this),
+                              generation = smoothGeneration, params,
+                              deriveInBackground](TSharedPtr<VolumeCPUData> VolDat) {
+             if (!weakThis.IsValid() || weakThis->smoothGeneration != generation)
+                 return;
+
+             deriveInBackground([params, VolDat]() {
+                 return TVariant<DerivedVolumeData, FString>(TInPlaceType<DerivedVolumeData>(),
+                                                             deriveVolumeData(params, VolDat));
+             });
+         }});
+}
 
-             auto texDat = VolumeTextureSmoothed->GetPlatformData()->Mips[0].BulkData.Lock(
-                 EBulkDataLockFlags::LOCK_READ_WRITE);
-             FMemory::Memcpy(texDat, VolDat->GetData(), sizeof(float) * VolDat->Num());
-             VolumeTextureSmoothed->GetPlatformData()->Mips[0].BulkData.Unlock();
+void UVolumeDataComponent::onVolumeSmoothed(const DeriveParameters &Params,
+                                            const TVariant<DerivedVolumeData, FString> &Ret) {
+    if (Ret.IsType<FString>()) {
+        processError(Ret.Get<FString>());
+        return;
+    }
 
-             VolumeTextureSmoothed->UpdateResource();
+    auto &derived = Ret.Get<DerivedVolumeData>();
+    VolumeTextureSmoothed =
+        VolumeData::CreateTextureFromCPUData(*derived.CPUData, Params.VoxTy, Params.Dimension);
+    applyDerivedSmoothedVolumeData(Params, derived);
 
-             if (keepVolumeInCPU)
-                 volumeCPUDataSmoothed = std::move(*VolDat);
+    OnVolumeDataChanged.Broadcast(this);
+}
 
-             OnVolumeDataChanged.Broadcast(this);
-         }});
+UVolumeDataComponent::DeriveParameters
+UVolumeDataComponent::makeDeriveParameters(ESupportedVoxelType VoxTy,
+                                           const FIntVector3 &Dimension) const {
+    // Without a renderer, e.g. on dedicated servers, smooth the voxels kept in CPU instead.
+    // So are larger radii, which cost O(Radius) per voxel on GPU for max and min, but O(1) on CPU.
+    return {.VoxTy = VoxTy,
+            .Dimension = Dimension,
+            .KeepVolumeInCPU = keepVolumeInCPU,
+            .KeepVolumeGradient = keepVolumeGradient,
+            .KeepSmoothedVolume = keepSmoothedVolume,
+            .SmoothOnCPU = keepVolumeInCPU && (!FApp::CanEverRender() || VolumeSmoothRadius > 1),
+            .SmoothType = VolumeSmoothType,
+            .SmoothDimension = VolumeSmoothDimension,
+            .SmoothRadius = VolumeSmoothRadius};
+}
+
+void UVolumeDataComponent::applyDerivedVolumeData(const DerivedVolumeData &Derived) {
+    volumeCPUData = keepVolumeInCPU ? Derived.CPUData : nullptr;
+    volumeMinMaxTree = volumeCPUData.IsValid() ? Derived.MinMaxTree : nullptr;
+    volumeGradient = volumeCPUData.IsValid() && keepVolumeGradient ? Derived.Gradient : nullptr;
+    volumeCPUDataSmoothed.Reset();
+    volumeMinMaxTreeSmoothed.Reset();
+    volumeGradientSmoothed.Reset();
+}
+
+void UVolumeDataComponent::applyDerivedSmoothedVolumeData(
+    const DeriveParameters &Params, const DerivedVolumeData &DerivedSmoothed) {
+    if (!Params.KeepVolumeInCPU)
+        return;
+
+    volumeCPUDataSmoothed = DerivedSmoothed.CPUData;
+    volumeMinMaxTreeSmoothed = DerivedSmoothed.MinMaxTree;
+    volumeGradientSmoothed = keepVolumeGradient ? DerivedSmoothed.Gradient : nullptr;
+}
+
+void UVolumeDataComponent::takeOrGenerateSmoothedVolume(const DeriveParameters &Params,
+                                                        UVolumeTexture *TextureSmoothed,
+                                                        const DerivedVolumeData &DerivedSmoothed) {
+    if (!TextureSmoothed || Params != makeDeriveParameters(Params.VoxTy, Params.Dimension)) {
+        generateSmoothedVolume();
+        return;
+    }
+
+    ++smoothGeneration;
+    VolumeTextureSmoothed = TextureSmoothed;
+    applyDerivedSmoothedVolumeData(Params, DerivedSmoothed);
+}
+
+UVolumeDataComponent::DerivedVolumeData
+UVolumeDataComponent::deriveVolumeData(const DeriveParameters &Params,
+                                       const TSharedPtr<const VolumeCPUData> &VolDat) {
+    DerivedVolumeData derived{.CPUData = VolDat};
+    if (Params.KeepVolumeInCPU) {
+        derived.MinMaxTree = createVolumeMinMaxTree(Params, VolDat);
+        derived.Gradient = createVolumeGradient(Params, VolDat);
+    }
+    return derived;
+}
+
+TVariant<UVolumeDataComponent::DerivedVolumeData, FString>
+UVolumeDataComponent::deriveSmoothedVolumeData(const DeriveParameters &Params,
+                                               const VolumeCPUData &VolDat) {
+    using RetType = TVariant<DerivedVolumeData, FString>;
+
+    auto volDat = MakeShared<VolumeCPUData>();
+    auto errMsg = VolumeData::SmoothCPUData({.SmoothTy = Params.SmoothType,
+                                             .SmoothDim = Params.SmoothDimension,
+                                             .Radius = Params.SmoothRadius,
+                                             .VoxTy = Params.VoxTy,
+                                             .Dimension = Params.Dimension},
+                                            VolDat, *volDat);
+    if (errMsg.IsSet())
+        return RetType(TInPlaceType<FString>(), errMsg.GetValue());
+
+    return RetType(TInPlaceType<DerivedVolumeData>(), deriveVolumeData(Params, volDat));
+}
+
+TSharedPtr<const FVolumeMinMaxTree>
+UVolumeDataComponent::createVolumeMinMaxTree(const DeriveParameters &Params,
+                                             const TSharedPtr<const VolumeCPUData> &VolDat) {
+    if (!VolDat.IsValid() || VolDat->IsEmpty())
+        return nullptr;
+
+    return FVolumeMinMaxTree::Create(
+        {.VoxelType = Params.VoxTy, .Dimension = Params.Dimension, .Data = VolDat->GetData()});
+}
+
+TSharedPtr<const FVolumeGradient>
+UVolumeDataComponent::createVolumeGradient(const DeriveParameters &Params,
+                                           const TSharedPtr<const VolumeCPUData> &VolDat) {
+    if (!Params.KeepVolumeGradient || !VolDat.IsValid() || VolDat->IsEmpty())
+        return nullptr;
+
+    return FVolumeGradient::Create(
+        {.VoxelType = Params.VoxTy, .Dimension = Params.Dimension, .Data = VolDat->GetData()});
+}
+
+void UVolumeDataComponent::SetKeepVolumeGradient(bool Keep) {
+    keepVolumeGradient = Keep;
+    if (!keepVolumeGradient) {
+        volumeGradient.Reset();
+        volumeGradientSmoothed.Reset();
+        return;
+    }
+
+    auto params = makeDeriveParameters(prevVolumeDataDesc.VoxTy, prevVolumeDataDesc.Dimension);
+    if (!volumeGradient.IsValid())
+        volumeGradient = createVolumeGradient(params, volumeCPUData);
+    if (!volumeGradientSmoothed.IsValid())
+        volumeGradientSmoothed = createVolumeGradient(params, volumeCPUDataSmoothed);
 }
 
 void UVolumeDataComponent::createDefaultTFTexture() {
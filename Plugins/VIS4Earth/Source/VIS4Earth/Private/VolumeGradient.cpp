@@ -0,0 +1,98 @@
+#include "VolumeGradient.h"
+
+#include <array>
+
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+
+TSharedPtr<const FVolumeGradient> FVolumeGradient::Create(const Parameters &Params) {
+    if (!Params.Data || Params.Dimension.X <= 0 || Params.Dimension.Y <= 0 ||
+        Params.Dimension.Z <= 0)
+        return nullptr;
+
+    TSharedPtr<FVolumeGradient> gradient = MakeShareable(new FVolumeGradient());
+    switch (Params.VoxelType) {
+    case ESupportedVoxelType::UInt8:
+        gradient->build<uint8>(Params);
+        break;
+    case ESupportedVoxelType::UInt16:
+        gradient->build<uint16>(Params);
+        break;
+    case ESupportedVoxelType::Float32:
+        gradient->build<float>(Params);
+        break;
+    default:
+        return nullptr;
+    }
+
+    return gradient;
+}
+
+template <SupportedVoxelType T> void FVolumeGradient::build(const Parameters &Params) {
+    dimension = Params.Dimension;
+    auto &dim = Params.Dimension;
+    auto src = reinterpret_cast<const T *>(Params.Data);
+    gradients.SetNumUninitialized(static_cast<int64>(dim.Z) * dim.Y * dim.X);
+
+    ParallelFor(dim.Z * dim.Y, [&](int32 rowIdx) {
+        auto y = rowIdx % dim.Y;
+        auto z = rowIdx / dim.Y;
+
+        // Rows of the center, -Y, +Y, -Z and +Z neighbors in float, clamped to the volume
+        enum ERow { Center = 0, YPrev, YNext, ZPrev, ZNext };
+        std::array<int32, 2> ys = {std::max(y - 1, 0), std::min(y + 1, dim.Y - 1)};
+        std::array<int32, 2> zs = {std::max(z - 1, 0), std::min(z + 1, dim.Z - 1)};
+        std::array<TArray<float>, 5> rows;
+        auto load = [&](ERow Row, int32 RowY, int32 RowZ) {
+            auto srcRow = src + (static_cast<int64>(RowZ) * dim.Y + RowY) * dim.X;
+            rows[Row].SetNumUninitialized(dim.X);
+            for (int32 x = 0; x < dim.X; ++x)
+                rows[Row][x] = static_cast<float>(srcRow[x]);
+        };
+        load(Center, y, z);
+        load(YPrev, ys[0], z);
+        load(YNext, ys[1], z);
+        load(ZPrev, y, zs[0]);
+        load(ZNext, y, zs[1]);
+        auto yScale = ys[1] == ys[0] ? 0.f : 1.f / (ys[1] - ys[0]);
+        auto zScale = zs[1] == zs[0] ? 0.f : 1.f / (zs[1] - zs[0]);
+
+        auto dst = gradients.GetData() + static_cast<int64>(rowIdx) * dim.X;
+        auto diff = [&](int32 x) {
+            auto xPrev = std::max(x - 1, 0);
+            auto xNext = std::min(x + 1, dim.X - 1);
+            dst[x] = FVector3f(
+                xNext == xPrev ? 0.f
+                               : (rows[Center][xNext] - rows[Center][xPrev]) / (xNext - xPrev),
+                (rows[YNext][x] - rows[YPrev][x]) * yScale,
+                (rows[ZNext][x] - rows[ZPrev][x]) * zScale);
+        };
+
+        // Voxels in [1, dim.X - 1) have both X neighbors
+        diff(0);
+        int32 x = 1;
+        auto half = VectorSetFloat1(.5f);
+        auto yScales = VectorSetFloat1(yScale);
+        auto zScales = VectorSetFloat1(zScale);
+        for (; x + 4 <= dim.X - 1; x += 4) {
+            alignas(16) std::array<std::array<float, 4>, 3> lanes;
+            VectorStoreAligned(
+                VectorMultiply(VectorSubtract(VectorLoad(&rows[Center][x + 1]),
+                                              VectorLoad(&rows[Center][x - 1])),
+                               half),
+                lanes[0].data());
+            VectorStoreAligned(VectorMultiply(VectorSubtract(VectorLoad(&rows[YNext][x]),
+                                                             VectorLoad(&rows[YPrev][x])),
+                                              yScales),
+                               lanes[1].data());
+            VectorStoreAligned(VectorMultiply(VectorSubtract(VectorLoad(&rows[ZNext][x]),
+                                                             VectorLoad(&rows[ZPrev][x])),
+                                              zScales),
+                               lanes[2].data());
+            for (int32 i = 0; i < 4; ++i)
+                dst[x + i] = FVector3f(lanes[0][i], lanes[1][i], lanes[2][i]);
+        }
+        for (; x < dim.X; ++x)
+            diff(x);
+    });
+}
@@ -0,0 +1,157 @@
+#include "VolumeMinMaxTree.h"
+
+#include <algorithm>
+
+#include "Async/ParallelFor.h"
+
+TSharedPtr<const FVolumeMinMaxTree> FVolumeMinMaxTree::Create(const Parameters &Params) {
+    if (!Params.Data || Params.Dimension.X <= 0 || Params.Dimension.Y <= 0 ||
+        Params.Dimension.Z <= 0)
+        return nullptr;
+
+    TSharedPtr<FVolumeMinMaxTree> tree = MakeShareable(new FVolumeMinMaxTree());
+    switch (Params.VoxelType) {
+    case ESupportedVoxelType::UInt8:
+        tree->build<uint8>(Params);
+        break;
+    case ESupportedVoxelType::UInt16:
+        tree->build<uint16>(Params);
+        break;
+    case ESupportedVoxelType::Float32:
+        tree->build<float>(Params);
+        break;
+    default:
+        return nullptr;
+    }
+    tree->buildIntervalTrees();
+
+    return tree;
+}
+
+template <SupportedVoxelType T> void FVolumeMinMaxTree::build(const Parameters &Params) {
+    auto &dim = Params.Dimension;
+    auto src = reinterpret_cast<const T *>(Params.Data);
+
+    auto &leaves = levels.Emplace_GetRef();
+    leaves.Dimension = FIntVector3(FMath::DivideAndRoundUp(dim.X, BlockSize),
+                                   FMath::DivideAndRoundUp(dim.Y, BlockSize),
+                                   FMath::DivideAndRoundUp(dim.Z, BlockSize));
+    leaves.Ranges.SetNumUninitialized(leaves.Dimension.X * leaves.Dimension.Y *
+                                      leaves.Dimension.Z);
+
+    ParallelFor(leaves.Dimension.Z * leaves.Dimension.Y, [&](int32 rowIdx) {
+        FIntVector3 blockCoord(0, rowIdx % leaves.Dimension.Y, rowIdx / leaves.Dimension.Y);
+        for (; blockCoord.X < leaves.Dimension.X; ++blockCoord.X) {
+            // Corners of the last cells of a block are on the first voxels of the next block
+            auto min = blockCoord * BlockSize;
+            FIntVector3 max(std::min(min.X + BlockSize, dim.X - 1),
+                            std::min(min.Y + BlockSize, dim.Y - 1),
+                            std::min(min.Z + BlockSize, dim.Z - 1));
+
+            FVector2f range(std::numeric_limits<float>::max(),
+                            std::numeric_limits<float>::lowest());
+            for (int32 z = min.Z; z <= max.Z; ++z)
+                for (int32 y = min.Y; y <= max.Y; ++y) {
+                    auto srcRow = src + (static_cast<int64>(z) * dim.Y + y) * dim.X;
+                    for (int32 x = min.X; x <= max.X; ++x) {
+                        range.X = std::min(range.X, static_cast<float>(srcRow[x]));
+                        range.Y = std::max(range.Y, static_cast<float>(srcRow[x]));
+                    }
+                }
+            leaves.Ranges[leaves.GetIndex(blockCoord)] = range;
+        }
+    });
+
+    while (levels.Last().Dimension != FIntVector3(1, 1, 1)) {
+        Level upper;
+        {
+            auto &lowerDim = levels.Last().Dimension;
+            upper.Dimension = FIntVector3(FMath::DivideAndRoundUp(lowerDim.X, 2),
+                                          FMath::DivideAndRoundUp(lowerDim.Y, 2),
+                                          FMath::DivideAndRoundUp(lowerDim.Z, 2));
+        }
+        upper.Ranges.Init(
+            FVector2f(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest()),
+            upper.Dimension.X * upper.Dimension.Y * upper.Dimension.Z);
+
+        auto &lower = levels.Last();
+        FIntVector3 coord;
+        for (coord.Z = 0; coord.Z < lower.Dimension.Z; ++coord.Z)
+            for (coord.Y = 0; coord.Y < lower.Dimension.Y; ++coord.Y)
+                for (coord.X = 0; coord.X < lower.Dimension.X; ++coord.X) {
+                    auto &lowerRange = lower.Ranges[lower.GetIndex(coord)];
+                    auto &upperRange = upper.Ranges[upper.GetIndex(coord / 2)];
+                    upperRange.X = std::min(upperRange.X, lowerRange.X);
+                    upperRange.Y = std::max(upperRange.Y, lowerRange.Y);
+                }
+
+        levels.Emplace(MoveTemp(upper));
+    }
+}
+
+void FVolumeMinMaxTree::buildIntervalTrees() {
+    auto &leaves = levels[0];
+    auto blockPerLayer = leaves.Dimension.X * leaves.Dimension.Y;
+
+    layers.SetNum(leaves.Dimension.Z);
+    ParallelFor(leaves.Dimension.Z, [&](int32 blockZ) {
+        // Blocks of a constant are never crossed, thus left out
+        TArray<Interval> intervals;
+        for (int32 blockIdx = 0; blockIdx < blockPerLayer; ++blockIdx) {
+            auto &range = leaves.Ranges[blockZ * blockPerLayer + blockIdx];
+            if (range.X < range.Y)
+                intervals.Add({range, blockIdx});
+        }
+
+        auto &layer = layers[blockZ];
+        layer.ByMin.Reserve(intervals.Num());
+        layer.ByMax.Reserve(intervals.Num());
+        buildIntervalNode(layer, MoveTemp(intervals));
+    });
+}
+
+int32 FVolumeMinMaxTree::buildIntervalNode(IntervalTree &Tree, TArray<Interval> &&Intervals) {
+    if (Intervals.IsEmpty())
+        return INDEX_NONE;
+
+    // The median of midpoints lies in its own interval, so that every node keeps an interval and
+    // halves the rest on each side
+    auto mid = Intervals.Num() / 2;
+    std::nth_element(Intervals.GetData(), Intervals.GetData() + mid,
+                     Intervals.GetData() + Intervals.Num(),
+                     [](const Interval &A, const Interval &B) {
+                         return A.Range.X + A.Range.Y < B.Range.X + B.Range.Y;
+                     });
+    auto center = .5f * (Intervals[mid].Range.X + Intervals[mid].Range.Y);
+
+    TArray<Interval> lower, upper;
+    auto start = Tree.ByMin.Num();
+    for (auto &interval : Intervals)
+        if (interval.Range.Y < center)
+            lower.Add(interval);
+        else if (interval.Range.X > center)
+            upper.Add(interval);
+        else {
+            Tree.ByMin.Add(interval);
+            Tree.ByMax.Add(interval);
+        }
+    auto end = Tree.ByMin.Num();
+    Intervals.Empty();
+
+    std::sort(Tree.ByMin.GetData() + start, Tree.ByMin.GetData() + end,
+              [](const Interval &A, const Interval &B) { return A.Range.X < B.Range.X; });
+    std::sort(Tree.ByMax.GetData() + start, Tree.ByMax.GetData() + end,
+              [](const Interval &A, const Interval &B) { return A.Range.Y > B.Range.Y; });
+
+    auto nodeIdx = Tree.Nodes.AddDefaulted();
+    Tree.Nodes[nodeIdx].Center = center;
+    Tree.Nodes[nodeIdx].Start = start;
+    Tree.Nodes[nodeIdx].End = end;
+    // Not through a reference, for children reallocate Nodes
+    auto left = buildIntervalNode(Tree, MoveTemp(lower));
+    Tree.Nodes[nodeIdx].Left = left;
+    auto right = buildIntervalNode(Tree, MoveTemp(upper));
+    Tree.Nodes[nodeIdx].Right = right;
+
+    return nodeIdx;
+}
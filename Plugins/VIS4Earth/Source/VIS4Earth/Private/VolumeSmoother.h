@@ -20,12 +20,18 @@ class VIS4EARTH_API FVolumeSmoothShader : public FGlobalShader {
 
     BEGIN_SHADER_PARAMETER_STRUCT(FParameters, VIS4EARTH_API)
     SHADER_PARAMETER(int, SmoothTy)
-    SHADER_PARAMETER(int, SmoothDim)
+    SHADER_PARAMETER(int, SmoothAxis)
+    SHADER_PARAMETER(int, Radius)
     SHADER_PARAMETER(FIntVector3, VolDim)
     SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture3D, VolInput)
+    SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float>, VolInputBuffer)
     SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<float>, VolOutput)
     END_SHADER_PARAMETER_STRUCT()
 
+    // Set in the first pass, which reads the volume texture instead of the previous pass
+    class FFromTextureDim : SHADER_PERMUTATION_BOOL("FROM_TEXTURE");
+    using FPermutationDomain = TShaderPermutationDomain<FFromTextureDim>;
+
     static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters &Parameters) {
         return true;
     }
@@ -45,8 +51,13 @@ class VIS4EARTH_API FVolumeSmoother {
     struct Parameters {
         EVolumeSmoothType SmoothType;
         EVolumeSmoothDimension SmoothDimension;
+        // Of the neighborhood in voxels along each smoothed axis. Smoothed in one pass per axis,
+        // costing O(1) per voxel for averages and O(Radius) for max and min.
+        int32 Radius = 1;
+        // Of VolumeTexture, which smoothed voxels keep
+        ESupportedVoxelType VoxelType;
         TObjectPtr<UVolumeTexture> VolumeTexture;
-        TFunction<void(TSharedPtr<TArray<float>> VolDat)> FinishedCallback;
+        TFunction<void(TSharedPtr<VolumeCPUData> VolDat)> FinishedCallback;
     };
     static void Exec(const Parameters &Params) {
         if (IsInRenderingThread()) {
@@ -62,46 +73,79 @@ class VIS4EARTH_API FVolumeSmoother {
     static void exec(FRHICommandListImmediate &RHICmdList, const Parameters &Params) {
         if (!Params.VolumeTexture)
             return;
+        auto voxSz = VolumeData::GetVoxelSize(Params.VoxelType);
+        if (voxSz == 0)
+            return;
 
         FRDGBuilder grphBldr(RHICmdList);
 
-        auto shaderParams = grphBldr.AllocParameters<FVolumeSmoothShader::FParameters>();
         FUint32Vector3 volDim(Params.VolumeTexture->GetSizeX(), Params.VolumeTexture->GetSizeY(),
                               Params.VolumeTexture->GetSizeZ());
-        auto smoothedVolBuf = grphBldr.CreateBuffer(
-            FRDGBufferDesc::CreateBufferDesc(sizeof(float), volDim.X * volDim.Y * volDim.Z),
-            *VIS4EARTH_GET_NAME_IN_FUNCTION("Smoothed Volume Buffer"));
-        {
-            shaderParams->SmoothTy = static_cast<int>(Params.SmoothType);
-            shaderParams->SmoothDim = static_cast<int>(Params.SmoothDimension);
-
-            shaderParams->VolDim.X = volDim.X;
-            shaderParams->VolDim.Y = volDim.Y;
-            shaderParams->VolDim.Z = volDim.Z;
-
-            auto extrnlTexRDG = RegisterExternalTexture(
-                grphBldr, Params.VolumeTexture->GetResource()->GetTexture3DRHI(),
-                *VIS4EARTH_GET_NAME_IN_FUNCTION("Volume Texture"));
-            shaderParams->VolInput = grphBldr.CreateSRV(FRDGTextureSRVDesc(extrnlTexRDG));
-
-            shaderParams->VolOutput =
-                grphBldr.CreateUAV(FRDGBufferUAVDesc(smoothedVolBuf, EPixelFormat::PF_R32_FLOAT));
-        }
+        auto voxNum = volDim.X * volDim.Y * volDim.Z;
+        auto smoothedVolBuf =
+            grphBldr.CreateBuffer(FRDGBufferDesc::CreateBufferDesc(voxSz, voxNum),
+                                  *VIS4EARTH_GET_NAME_IN_FUNCTION("Smoothed Volume Buffer"));
+        auto extrnlTexRDG = RegisterExternalTexture(
+            grphBldr, Params.VolumeTexture->GetResource()->GetTexture3DRHI(),
+            *VIS4EARTH_GET_NAME_IN_FUNCTION("Volume Texture"));
+
+        // Separable, filtering X, Y and then Z only over XYZ. Passes in between keep normalized
+        // voxels in float.
+        auto passNum = Params.SmoothDimension == EVolumeSmoothDimension::XYZ ? 3 : 2;
+        FRDGBufferRef prevBuf = nullptr;
+        for (int32 axis = 0; axis < passNum; ++axis) {
+            auto isLast = axis == passNum - 1;
+            auto buf = isLast ? smoothedVolBuf
+                              : grphBldr.CreateBuffer(
+                                    FRDGBufferDesc::CreateBufferDesc(sizeof(float), voxNum),
+                                    *VIS4EARTH_GET_NAME_IN_FUNCTION("Partially Smoothed Volume"));
+
+            auto shaderParams = grphBldr.AllocParameters<FVolumeSmoothShader::FParameters>();
+            {
+                shaderParams->SmoothTy = static_cast<int>(Params.SmoothType);
+                shaderParams->SmoothAxis = axis;
+                shaderParams->Radius = Params.Radius;
+
+                shaderParams->VolDim.X = volDim.X;
+                shaderParams->VolDim.Y = volDim.Y;
+                shaderParams->VolDim.Z = volDim.Z;
+
+                if (axis == 0)
+                    shaderParams->VolInput = grphBldr.CreateSRV(FRDGTextureSRVDesc(extrnlTexRDG));
+                else
+                    shaderParams->VolInputBuffer =
+                        grphBldr.CreateSRV(FRDGBufferSRVDesc(prevBuf, PF_R32_FLOAT));
+
+                // Typed as the volume texture in the last pass, so that normalized voxels are
+                // quantized on writing
+                shaderParams->VolOutput = grphBldr.CreateUAV(FRDGBufferUAVDesc(
+                    buf, isLast ? VolumeData::GetVoxelPixelFormat(Params.VoxelType)
+                                : PF_R32_FLOAT));
+            }
 
-        TShaderMapRef<FVolumeSmoothShader> shader(GetGlobalShaderMap(GMaxRHIFeatureLevel));
-        FComputeShaderUtils::AddPass(
-            grphBldr, RDG_EVENT_NAME("Volume Smoothing"),
-            ERDGPassFlags::Compute | ERDGPassFlags::NeverCull, shader, shaderParams,
-            FIntVector(
-                FMath::DivideAndRoundUp(shaderParams->VolDim.X, VIS4EARTH_THREAD_PER_GROUP_X),
-                FMath::DivideAndRoundUp(shaderParams->VolDim.Y, VIS4EARTH_THREAD_PER_GROUP_Y),
-                FMath::DivideAndRoundUp(shaderParams->VolDim.Z, VIS4EARTH_THREAD_PER_GROUP_Z)));
+            FVolumeSmoothShader::FPermutationDomain permVec;
+            permVec.Set<FVolumeSmoothShader::FFromTextureDim>(axis == 0);
+            TShaderMapRef<FVolumeSmoothShader> shader(GetGlobalShaderMap(GMaxRHIFeatureLevel),
+                                                      permVec);
+
+            // A thread per line along the axis
+            auto lineNum = axis == 0   ? FIntPoint(volDim.Y, volDim.Z)
+                           : axis == 1 ? FIntPoint(volDim.X, volDim.Z)
+                                       : FIntPoint(volDim.X, volDim.Y);
+            FComputeShaderUtils::AddPass(
+                grphBldr, RDG_EVENT_NAME("Volume Smoothing"),
+                ERDGPassFlags::Compute | ERDGPassFlags::NeverCull, shader, shaderParams,
+                FIntVector(FMath::DivideAndRoundUp(lineNum.X, VIS4EARTH_THREAD_PER_GROUP_X),
+                           FMath::DivideAndRoundUp(lineNum.Y, VIS4EARTH_THREAD_PER_GROUP_Y), 1));
+
+            prevBuf = buf;
+        }
 
         auto bufReadback =
             new FRHIGPUBufferReadback(*VIS4EARTH_GET_NAME_IN_FUNCTION("Readback Smoothed Volume"));
         AddEnqueueCopyPass(grphBldr, bufReadback, smoothedVolBuf, smoothedVolBuf->GetSize());
 
-        auto waitTask = [bufReadback, volDim,
+        auto waitTask = [bufReadback, volDim, voxSz,
                          callback = Params.FinishedCallback](auto &&waitTask) -> void {
             if (!bufReadback->IsReady()) {
                 AsyncTask(ENamedThreads::ActualRenderingThread,
@@ -109,12 +153,10 @@ class VIS4EARTH_API FVolumeSmoother {
                 return;
             }
 
-            auto bufNum = volDim.X * volDim.Y * volDim.Z;
-            auto bufSz = sizeof(float) * bufNum;
+            auto bufSz = voxSz * volDim.X * volDim.Y * volDim.Z;
 
-            auto volDat = MakeShared<TArray<float>>();
-            volDat->SetNum(bufNum);
-            FMemory::Memcpy(volDat->GetData(), bufReadback->Lock(bufSz), bufSz);
+            TSharedPtr<VolumeCPUData> volDat = MakeShared<VolumeCPUData>();
+            FMemory::Memcpy(volDat->Own(bufSz).GetData(), bufReadback->Lock(bufSz), bufSz);
 
             AsyncTask(ENamedThreads::GameThread, [volDat, callback]() { callback(volDat); });
 
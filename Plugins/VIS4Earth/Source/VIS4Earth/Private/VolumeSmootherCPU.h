@@ -0,0 +1,252 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+#include "Math/VectorRegister.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeSmootherCPU
+ * Function:
+ * -- Smooths a volume on CPU with the same results as FVolumeSmoother, for hosts that cannot
+ *    render, e.g. dedicated servers and automated tests. Smoothed voxels keep the voxel type.
+ * -- The neighborhood clamped to the volume is a box, so that it is filtered along X, Y and
+ *    then Z in turn. X and Y are filtered per slice in parallel, then Z per row in parallel.
+ * -- Averaging, maximum and minimum cost O(1) per voxel for any radius, with running sums and
+ *    the van Herk/Gil-Werman algorithm respectively. Lines along Y and Z are filtered many
+ *    voxels at a time, so that the inner loops run across X 4 voxels at a time.
+ */
+class FVolumeSmootherCPU {
+  public:
+    struct Parameters {
+        EVolumeSmoothType SmoothType;
+        EVolumeSmoothDimension SmoothDimension;
+        // Of the neighborhood in voxels along each smoothed axis
+        int32 Radius = 1;
+        ESupportedVoxelType VoxelType;
+        FIntVector3 Dimension;
+        const uint8 *Src;
+        // Of VoxelType. Voxels are filtered normalized by VolumeData::GetVoxelMinMaxExtent, as
+        // they are read from the volume texture on GPU, and quantized back as they are written.
+        uint8 *Dst;
+    };
+
+    static void Exec(const Parameters &Params) {
+        switch (Params.VoxelType) {
+        case ESupportedVoxelType::UInt8:
+            dispatch<uint8>(Params);
+            break;
+        case ESupportedVoxelType::UInt16:
+            dispatch<uint16>(Params);
+            break;
+        case ESupportedVoxelType::Float32:
+            dispatch<float>(Params);
+            break;
+        default:
+            break;
+        }
+    }
+
+  private:
+    template <SupportedVoxelType T> static void dispatch(const Parameters &Params) {
+        switch (Params.SmoothType) {
+        case EVolumeSmoothType::Avg:
+            exec<T, EVolumeSmoothType::Avg>(Params);
+            break;
+        case EVolumeSmoothType::Max:
+            exec<T, EVolumeSmoothType::Max>(Params);
+            break;
+        case EVolumeSmoothType::Min:
+            exec<T, EVolumeSmoothType::Min>(Params);
+            break;
+        default:
+            break;
+        }
+    }
+
+    struct Scratch {
+        TArray64<double> Sums;
+        TArray64<float> Forward;
+        TArray64<float> Backward;
+    };
+
+    template <typename ElemType> static ElemType *reserve(TArray64<ElemType> &Arr, int64 Num) {
+        if (Arr.Num() < Num)
+            Arr.SetNumUninitialized(Num);
+        return Arr.GetData();
+    }
+
+    // Averages Len lines at once. Positions along the lines are DstStride and SrcStride voxels
+    // apart in Dst and Src respectively.
+    // The sum over a window is the difference of the prefix sums along the line, i.e. of the
+    // integral volume factorized per axis, at both of its ends. It is kept as a running sum in
+    // double, so that the cost per voxel does not depend on Radius.
+    static void averageLines(float *Dst, int64 DstStride, const float *Src, int64 SrcStride,
+                             int32 Num, int64 Len, int32 Radius, Scratch &Buf) {
+        auto sums = reserve(Buf.Sums, Len);
+        auto accumulate = [&](int32 Idx, double Sign) {
+            auto src = Src + Idx * SrcStride;
+            for (int64 l = 0; l < Len; ++l)
+                sums[l] += Sign * src[l];
+        };
+
+        for (int64 l = 0; l < Len; ++l)
+            sums[l] = 0.;
+        for (int32 i = 0; i <= std::min(Radius, Num - 1); ++i)
+            accumulate(i, 1.);
+
+        for (int32 i = 0; i < Num; ++i) {
+            auto invCnt = 1. / (std::min(i + Radius, Num - 1) - std::max(i - Radius, 0) + 1);
+            auto dst = Dst + i * DstStride;
+            for (int64 l = 0; l < Len; ++l)
+                dst[l] = static_cast<float>(sums[l] * invCnt);
+
+            if (i + Radius + 1 < Num)
+                accumulate(i + Radius + 1, 1.);
+            if (i - Radius >= 0)
+                accumulate(i - Radius, -1.);
+        }
+    }
+
+    // Dst[l] = Op(A[l], B[l]), 4 voxels at a time
+    template <EVolumeSmoothType SmoothTy>
+    static FORCEINLINE void combineLines(float *Dst, const float *A, const float *B, int64 Len) {
+        int64 l = 0;
+        for (; l + 4 <= Len; l += 4)
+            if constexpr (SmoothTy == EVolumeSmoothType::Max)
+                VectorStore(VectorMax(VectorLoad(A + l), VectorLoad(B + l)), Dst + l);
+            else
+                VectorStore(VectorMin(VectorLoad(A + l), VectorLoad(B + l)), Dst + l);
+        for (; l < Len; ++l)
+            if constexpr (SmoothTy == EVolumeSmoothType::Max)
+                Dst[l] = std::max(A[l], B[l]);
+            else
+                Dst[l] = std::min(A[l], B[l]);
+    }
+
+    // Takes the maximum or minimum of Len lines at once with the van Herk/Gil-Werman algorithm.
+    // Lines are padded by Radius on both ends and cut into blocks of the window size W. The
+    // window at padded position i covers the suffix of a block from i and the prefix of the next
+    // block to i + W - 1, which costs 3 comparisons per voxel for any radius.
+    template <EVolumeSmoothType SmoothTy>
+    static void morphLines(float *Dst, int64 DstStride, const float *Src, int64 SrcStride,
+                           int32 Num, int64 Len, int32 Radius, Scratch &Buf) {
+        static constexpr float Padding = SmoothTy == EVolumeSmoothType::Max
+                                             ? std::numeric_limits<float>::lowest()
+                                             : std::numeric_limits<float>::max();
+
+        auto winSz = 2 * Radius + 1;
+        auto padNum = FMath::DivideAndRoundUp(Num + 2 * Radius, winSz) * winSz;
+        auto fwd = reserve(Buf.Forward, static_cast<int64>(padNum) * Len);
+        auto bwd = reserve(Buf.Backward, static_cast<int64>(padNum) * Len);
+        auto loadLine = [&](float *Line, int32 PadIdx) {
+            auto idx = PadIdx - Radius;
+            if (idx >= 0 && idx < Num)
+                FMemory::Memcpy(Line, Src + idx * SrcStride, sizeof(float) * Len);
+            else
+                for (int64 l = 0; l < Len; ++l)
+                    Line[l] = Padding;
+        };
+        auto combineLine = [&](float *Line, const float *Prev, int32 PadIdx) {
+            auto idx = PadIdx - Radius;
+            if (idx >= 0 && idx < Num)
+                combineLines<SmoothTy>(Line, Prev, Src + idx * SrcStride, Len);
+            else
+                FMemory::Memcpy(Line, Prev, sizeof(float) * Len);
+        };
+
+        for (int32 blkStart = 0; blkStart < padNum; blkStart += winSz) {
+            loadLine(fwd + blkStart * Len, blkStart);
+            for (auto i = blkStart + 1; i < blkStart + winSz; ++i)
+                combineLine(fwd + i * Len, fwd + (i - 1) * Len, i);
+
+            auto blkLast = blkStart + winSz - 1;
+            loadLine(bwd + blkLast * Len, blkLast);
+            for (auto i = blkLast - 1; i >= blkStart; --i)
+                combineLine(bwd + i * Len, bwd + (i + 1) * Len, i);
+        }
+
+        // Padded position of voxel i is i + Radius, whose window starts at i
+        for (int32 i = 0; i < Num; ++i)
+            combineLines<SmoothTy>(Dst + i * DstStride, bwd + i * Len,
+                                   fwd + (i + winSz - 1) * Len, Len);
+    }
+
+    template <EVolumeSmoothType SmoothTy>
+    static void filterLines(float *Dst, int64 DstStride, const float *Src, int64 SrcStride,
+                            int32 Num, int64 Len, int32 Radius, Scratch &Buf) {
+        if constexpr (SmoothTy == EVolumeSmoothType::Avg)
+            averageLines(Dst, DstStride, Src, SrcStride, Num, Len, Radius, Buf);
+        else
+            morphLines<SmoothTy>(Dst, DstStride, Src, SrcStride, Num, Len, Radius, Buf);
+    }
+
+    template <SupportedVoxelType T>
+    static void quantizeLine(T *Dst, const float *Src, int64 Len, float Extent) {
+        for (int64 l = 0; l < Len; ++l)
+            if constexpr (std::is_floating_point_v<T>)
+                Dst[l] = Src[l];
+            else
+                Dst[l] = static_cast<T>(std::lround(Src[l] * Extent));
+    }
+
+    template <SupportedVoxelType T, EVolumeSmoothType SmoothTy>
+    static void exec(const Parameters &Params) {
+        auto &dim = Params.Dimension;
+        auto src = reinterpret_cast<const T *>(Params.Src);
+        auto dst = reinterpret_cast<T *>(Params.Dst);
+        auto voxPerSlice = static_cast<int64>(dim.Y) * dim.X;
+        auto isXYZ = Params.SmoothDimension == EVolumeSmoothDimension::XYZ;
+        auto vxExt = VolumeData::GetVoxelMinMaxExtent(Params.VoxelType).Get<2>();
+        auto invExt = 1.f / vxExt;
+
+        // Filtered over XY, which is then filtered over Z when smoothing over XYZ
+        TArray64<float> xyBuf;
+        if (isXYZ)
+            xyBuf.SetNumUninitialized(voxPerSlice * dim.Z);
+
+        ParallelFor(dim.Z, [&](int32 z) {
+            TArray<float> row;
+            TArray64<float> xSlice, xySlice;
+            Scratch buf;
+            row.SetNumUninitialized(dim.X);
+            xSlice.SetNumUninitialized(voxPerSlice);
+            if (!isXYZ)
+                xySlice.SetNumUninitialized(voxPerSlice);
+
+            auto srcSlice = src + z * voxPerSlice;
+            for (int32 y = 0; y < dim.Y; ++y) {
+                auto srcRow = srcSlice + static_cast<int64>(y) * dim.X;
+                for (int32 x = 0; x < dim.X; ++x)
+                    row[x] = static_cast<float>(srcRow[x]) * invExt;
+                filterLines<SmoothTy>(xSlice.GetData() + static_cast<int64>(y) * dim.X, 1,
+                                      row.GetData(), 1, dim.X, 1, Params.Radius, buf);
+            }
+
+            auto xyDat = isXYZ ? xyBuf.GetData() + z * voxPerSlice : xySlice.GetData();
+            filterLines<SmoothTy>(xyDat, dim.X, xSlice.GetData(), dim.X, dim.Y, dim.X,
+                                  Params.Radius, buf);
+            if (!isXYZ)
+                quantizeLine(dst + z * voxPerSlice, xyDat, voxPerSlice, vxExt);
+        });
+        if (!isXYZ)
+            return;
+
+        // Rows are filtered along Z in parallel, for slabs cannot be filtered apart along Z
+        ParallelFor(dim.Y, [&](int32 y) {
+            TArray64<float> zRows;
+            Scratch buf;
+            zRows.SetNumUninitialized(static_cast<int64>(dim.Z) * dim.X);
+
+            auto offs = static_cast<int64>(y) * dim.X;
+            filterLines<SmoothTy>(zRows.GetData(), dim.X, xyBuf.GetData() + offs, voxPerSlice,
+                                  dim.Z, dim.X, Params.Radius, buf);
+            for (int32 z = 0; z < dim.Z; ++z)
+                quantizeLine(dst + z * voxPerSlice + offs,
+                             zRows.GetData() + static_cast<int64>(z) * dim.X, dim.X, vxExt);
+        });
+    }
+};
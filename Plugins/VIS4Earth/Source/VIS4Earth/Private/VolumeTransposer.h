@@ -0,0 +1,148 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <array>
+#include <utility>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeTransposer
+ * Function:
+ * -- Transposes (permutes and flips axes of) a volume in cache-sized 3D blocks.
+ * -- Blocks are processed in parallel over Z-slabs of the transposed volume.
+ * -- Each permutation/flip combination is a separate instantiation, so that the inner loop is
+ *    a (reversed) contiguous copy whenever the X axis is kept.
+ */
+class FVolumeTransposer {
+  public:
+    struct Parameters {
+        ESupportedVoxelType VoxelType;
+        FIntVector3 Axis;
+        FIntVector3 Dimension;
+        const uint8 *Src;
+        uint8 *Dst;
+        // Checked per slab for cancellation. Progress is increased by ProgressWeight in total.
+        VolumeData::LoadFromFileState *State = nullptr;
+        float ProgressWeight = 0.f;
+    };
+
+    static FIntVector3 GetTransposedDimension(const FIntVector3 &Axis,
+                                              const FIntVector3 &Dimension) {
+        return FIntVector3(Dimension[std::abs(Axis[0]) - 1], Dimension[std::abs(Axis[1]) - 1],
+                           Dimension[std::abs(Axis[2]) - 1]);
+    }
+
+    static void Exec(const Parameters &Params) {
+        switch (Params.VoxelType) {
+        case ESupportedVoxelType::UInt8:
+            dispatch<uint8>(Params);
+            break;
+        case ESupportedVoxelType::UInt16:
+            dispatch<uint16>(Params);
+            break;
+        case ESupportedVoxelType::Float32:
+            dispatch<float>(Params);
+            break;
+        default:
+            break;
+        }
+    }
+
+  private:
+    static constexpr std::array<std::array<int32, 3>, 6> Permutations = {
+        {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}}};
+    static constexpr int32 FlipCombinationNum = 8;
+
+    template <SupportedVoxelType T> static constexpr int32 getBlockSize() {
+        // Keep a source and a destination block within L1/L2
+        return sizeof(T) == 1 ? 32 : 16;
+    }
+
+    template <SupportedVoxelType T> static void dispatch(const Parameters &Params) {
+        int32 permIdx = 0;
+        for (; permIdx < static_cast<int32>(Permutations.size()); ++permIdx)
+            if (Permutations[permIdx][0] == std::abs(Params.Axis[0]) - 1 &&
+                Permutations[permIdx][1] == std::abs(Params.Axis[1]) - 1 &&
+                Permutations[permIdx][2] == std::abs(Params.Axis[2]) - 1)
+                break;
+        if (permIdx == static_cast<int32>(Permutations.size()))
+            return;
+
+        auto flipMask = (Params.Axis[0] < 0 ? 0b001 : 0) | (Params.Axis[1] < 0 ? 0b010 : 0) |
+                        (Params.Axis[2] < 0 ? 0b100 : 0);
+
+        static constexpr auto kernels =
+            []<size_t... Is>(std::index_sequence<Is...>) {
+                return std::array<void (*)(const Parameters &), sizeof...(Is)>{
+                    &exec<T, Is / FlipCombinationNum, Is % FlipCombinationNum>...};
+            }(std::make_index_sequence<Permutations.size() * FlipCombinationNum>());
+        kernels[permIdx * FlipCombinationNum + flipMask](Params);
+    }
+
+    template <SupportedVoxelType T, int32 PermIdx, int32 FlipMask>
+    static void exec(const Parameters &Params) {
+        static constexpr auto AxisMap = Permutations[PermIdx];
+        static constexpr auto BlockSz = getBlockSize<T>();
+
+        auto src = reinterpret_cast<const T *>(Params.Src);
+        auto dst = reinterpret_cast<T *>(Params.Dst);
+
+        auto &dim = Params.Dimension;
+        auto trDim = FIntVector3(dim[AxisMap[0]], dim[AxisMap[1]], dim[AxisMap[2]]);
+
+        // Offset in Src of moving one voxel along each axis of Dst
+        std::array<int64, 3> srcStrides = {1, dim.X, static_cast<int64>(dim.X) * dim.Y};
+        std::array<int64, 3> trSrcStrides;
+        int64 srcBase = 0;
+        for (int32 i = 0; i < 3; ++i) {
+            auto flip = ((FlipMask >> i) & 0b1) != 0;
+            trSrcStrides[i] = flip ? -srcStrides[AxisMap[i]] : srcStrides[AxisMap[i]];
+            if (flip)
+                srcBase += (trDim[i] - 1) * srcStrides[AxisMap[i]];
+        }
+
+        auto trVoxYxX = static_cast<int64>(trDim.Y) * trDim.X;
+        auto slabNum = FMath::DivideAndRoundUp(trDim.Z, BlockSz);
+        ParallelFor(slabNum, [&](int32 slabIdx) {
+            if (Params.State && Params.State->Cancelled)
+                return;
+
+            FIntVector3 blkStart(0, 0, slabIdx * BlockSz);
+            auto zEnd = std::min(blkStart.Z + BlockSz, trDim.Z);
+            for (blkStart.Y = 0; blkStart.Y < trDim.Y; blkStart.Y += BlockSz) {
+                auto yEnd = std::min(blkStart.Y + BlockSz, trDim.Y);
+                for (blkStart.X = 0; blkStart.X < trDim.X; blkStart.X += BlockSz) {
+                    auto xEnd = std::min(blkStart.X + BlockSz, trDim.X);
+                    auto xNum = xEnd - blkStart.X;
+
+                    for (int32 z = blkStart.Z; z < zEnd; ++z)
+                        for (int32 y = blkStart.Y; y < yEnd; ++y) {
+                            auto dstRow = dst + z * trVoxYxX + static_cast<int64>(y) * trDim.X +
+                                          blkStart.X;
+                            auto srcRow = src + srcBase + z * trSrcStrides[2] +
+                                          y * trSrcStrides[1] + blkStart.X * trSrcStrides[0];
+
+                            if constexpr (AxisMap[0] == 0) {
+                                // Rows stay contiguous in Src, let the compiler vectorize it
+                                static constexpr int64 SrcStrideX = (FlipMask & 0b1) != 0 ? -1 : 1;
+                                for (int32 x = 0; x < xNum; ++x)
+                                    dstRow[x] = srcRow[x * SrcStrideX];
+                            } else {
+                                auto srcStrideX = trSrcStrides[0];
+                                for (int32 x = 0; x < xNum; ++x)
+                                    dstRow[x] = srcRow[x * srcStrideX];
+                            }
+                        }
+                }
+            }
+
+            if (Params.State)
+                Params.State->Progress += Params.ProgressWeight / slabNum;
+        });
+    }
+};
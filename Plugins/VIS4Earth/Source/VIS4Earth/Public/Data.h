@@ -2,11 +2,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 
+#include "Async/MappedFileHandle.h"
 #include "CoreMinimal.h"
 #include "Curves/CurveLinearColor.h"
 #include "Engine/VolumeTexture.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "HAL/CriticalSection.h"
 
 #include "Util.h"
 
@@ -24,7 +28,8 @@ enum class ESupportedVoxelType : uint8 {
 UENUM()
 enum class EVolumeSmoothType : uint8 {
     Avg = 0 UMETA(DisplayName = "Average"),
-    Max UMETA(DisplayName = "Maximum")
+    Max UMETA(DisplayName = "Maximum"),
+    Min UMETA(DisplayName = "Minimum")
 };
 UENUM()
 enum class EVolumeSmoothDimension : uint8 {
@@ -32,38 +37,208 @@ enum class EVolumeSmoothDimension : uint8 {
     XY UMETA(DisplayName = "Smooth over XY Plane")
 };
 
+/*
+ * Class: VolumeCPUData
+ * Function:
+ * -- Holds voxels of a volume in CPU memory.
+ * -- Voxels are either owned by an array or aliased from a memory-mapped file.
+ */
+class VolumeCPUData {
+  public:
+    const uint8 *GetData() const {
+        return mappedRegion.IsValid() ? mappedRegion->GetMappedPtr() : owned.GetData();
+    }
+    int64 Num() const {
+        return mappedRegion.IsValid() ? mappedRegion->GetMappedSize() : owned.Num();
+    }
+    bool IsEmpty() const { return Num() == 0; }
+    bool IsMapped() const { return mappedRegion.IsValid(); }
+
+    // Releases the mapping and returns the owned array resized to Num bytes
+    TArray64<uint8> &Own(int64 Num) {
+        unmap();
+        owned.SetNumUninitialized(Num);
+        return owned;
+    }
+    void Empty() {
+        unmap();
+        owned.Empty();
+    }
+
+    bool MapFile(const FString &FilePath);
+    bool LoadFile(const FString &FilePath);
+
+  private:
+    TArray64<uint8> owned;
+    // Region must be released before the file handle
+    TSharedPtr<IMappedFileHandle> mappedFile;
+    TSharedPtr<IMappedFileRegion> mappedRegion;
+
+    void unmap() {
+        mappedRegion.Reset();
+        mappedFile.Reset();
+    }
+};
+
+/*
+ * Class: VolumeContainerHeader
+ * Function:
+ * -- Describes a bricked volume container, laid out as the header, the brick index and then the
+ *    bricks.
+ * -- Voxels are stored transposed, split into BrickSize^3 bricks in X-Y-Z order, and each brick
+ *    is compressed on its own. A brick whose CompressedSize equals its UncompressedSize is stored
+ *    as is.
+ */
+struct VolumeContainerHeader {
+    static constexpr uint32 Magic = 0x56453456; // "V4EV"
+    static constexpr uint32 Version = 1;
+
+    struct Brick {
+        // Relative to PayloadOffset
+        int64 Offset = 0;
+        int32 CompressedSize = 0;
+        int32 UncompressedSize = 0;
+
+        friend FArchive &operator<<(FArchive &Ar, Brick &Brick) {
+            return Ar << Brick.Offset << Brick.CompressedSize << Brick.UncompressedSize;
+        }
+    };
+
+    VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(ESupportedVoxelType, VoxTy, ESupportedVoxelType::None)
+    // Axis of the RAW volume the container was converted from. Only kept for reference.
+    VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, Axis, {1 VIS4EARTH_COMMA 2 VIS4EARTH_COMMA 3})
+    VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, Dimension, FIntVector::ZeroValue)
+    VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, BrickSize, 64)
+    VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FName, CompressionFormat, NAME_Oodle)
+    FVector2D LongtitudeRange = FVector2D::ZeroVector;
+    FVector2D LatitudeRange = FVector2D::ZeroVector;
+    FVector2D HeightRange = FVector2D::ZeroVector;
+    TArray<Brick> Bricks;
+    // Set when loaded
+    int64 PayloadOffset = 0;
+
+    FIntVector3 GetBrickNum() const {
+        return FIntVector3(FMath::DivideAndRoundUp(Dimension.X, BrickSize),
+                           FMath::DivideAndRoundUp(Dimension.Y, BrickSize),
+                           FMath::DivideAndRoundUp(Dimension.Z, BrickSize));
+    }
+    int32 GetBrickIndex(const FIntVector3 &BrickCoord) const {
+        auto brickNum = GetBrickNum();
+        return (BrickCoord.Z * brickNum.Y + BrickCoord.Y) * brickNum.X + BrickCoord.X;
+    }
+    // Voxel range [Min, Max) of a brick. Bricks on the far borders are clipped.
+    TTuple<FIntVector3, FIntVector3> GetBrickVoxelRange(const FIntVector3 &BrickCoord) const {
+        auto min = BrickCoord * BrickSize;
+        return MakeTuple(min, FIntVector3(std::min(min.X + BrickSize, Dimension.X),
+                                          std::min(min.Y + BrickSize, Dimension.Y),
+                                          std::min(min.Z + BrickSize, Dimension.Z)));
+    }
+
+    friend FArchive &operator<<(FArchive &Ar, VolumeContainerHeader &Header);
+};
+
 class VolumeData {
   public:
     struct LoadFromFileDesc {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(ESupportedVoxelType, VoxTy, ESupportedVoxelType::None)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, Axis, {1 VIS4EARTH_COMMA 2 VIS4EARTH_COMMA 3})
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, Dimension, FIntVector::ZeroValue)
+        // Region of interest in the transposed volume, sampled every ROIStride voxels in
+        // [ROIMin, ROIMax). A zero ROIMax selects the whole volume.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, ROIMin, FIntVector::ZeroValue)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, ROIMax, FIntVector::ZeroValue)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, ROIStride,
+                                         {1 VIS4EARTH_COMMA 1 VIS4EARTH_COMMA 1})
         FFilePath FilePath;
         FName Name;
     };
+    // Shared between a loading thread and its owner to report progress in [0,1] and to cancel
+    struct LoadFromFileState {
+        std::atomic<bool> Cancelled = false;
+        std::atomic<float> Progress = 0.f;
+    };
     static TVariant<UVolumeTexture *, FString>
     LoadFromFile(const LoadFromFileDesc &Desc,
-                 TOptional<std::reference_wrapper<TArray<uint8>>> VolumeOut = {});
+                 TOptional<std::reference_wrapper<VolumeCPUData>> VolumeOut = {});
+    // Reads and transposes the volume into VolumeOut, returning the transposed dimension.
+    // Can be called from any thread.
+    // Containers are read brick by brick, where Desc must match the container header, i.e.
+    // the same VoxTy and Dimension with the identity Axis.
+    static TVariant<FIntVector3, FString> LoadCPUDataFromFile(const LoadFromFileDesc &Desc,
+                                                              VolumeCPUData &VolumeOut,
+                                                              LoadFromFileState *State = nullptr);
+    // A volume file opened once for repeated loads from any thread, e.g. of bricks paged in on
+    // demand. Without memory-mapping, reads through Handle are serialized.
+    struct OpenedFile {
+        VolumeCPUData Mapped;
+        TUniquePtr<IFileHandle> Handle;
+        mutable FCriticalSection HandleMutex;
+        int64 FileSize = 0;
+        TOptional<VolumeContainerHeader> ContainerHeader;
+
+        bool Read(int64 Offset, uint8 *Dst, int64 Size) const;
+    };
+    static TVariant<TSharedRef<const OpenedFile>, FString> OpenFile(const FFilePath &FilePath);
+    // Same as above, but reads from File opened from Desc.FilePath instead of opening it again
+    static TVariant<FIntVector3, FString> LoadCPUDataFromFile(const LoadFromFileDesc &Desc,
+                                                              const OpenedFile &File,
+                                                              VolumeCPUData &VolumeOut,
+                                                              LoadFromFileState *State = nullptr);
+
+    static constexpr auto ContainerExtension = TEXT("v4ev");
+    static bool IsContainerFile(const FString &FilePath) {
+        return FPaths::GetExtension(FilePath).Equals(ContainerExtension, ESearchCase::IgnoreCase);
+    }
+    static TVariant<VolumeContainerHeader, FString>
+    LoadContainerHeaderFromFile(const FFilePath &FilePath);
+    // Bricks and compresses the transposed volume in VolDat, described by Header except for its
+    // brick index. Can be called from any thread.
+    static TOptional<FString> SaveCPUDataToContainer(const VolumeCPUData &VolDat,
+                                                     const VolumeContainerHeader &Header,
+                                                     const FFilePath &FilePath,
+                                                     LoadFromFileState *State = nullptr);
+    // Stages the voxels into a new transient texture. Must be called from the game thread.
+    static UVolumeTexture *CreateTextureFromCPUData(const VolumeCPUData &VolDat,
+                                                    ESupportedVoxelType VoxTy,
+                                                    const FIntVector3 &Dimension,
+                                                    const FName &Name = NAME_None);
 
     struct SmoothFromFlatArrayDesc {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothType, SmoothTy, EVolumeSmoothType::Avg)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothDimension, SmoothDim,
                                          EVolumeSmoothDimension::XYZ)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, Radius, 1)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(ESupportedVoxelType, VoxTy, ESupportedVoxelType::None)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, Dimension, FIntVector::ZeroValue)
         const TArray<uint8> &VolDat;
         FName Name;
     };
+    // Smooths on CPU into a texture of the same voxel type
     static TVariant<UVolumeTexture *, FString>
     SmoothFromFlatArray(const SmoothFromFlatArrayDesc &Desc,
                         TOptional<std::reference_wrapper<TArray<uint8>>> SmoothedVolOut = {});
 
+    struct SmoothCPUDataDesc {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothType, SmoothTy, EVolumeSmoothType::Avg)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothDimension, SmoothDim,
+                                         EVolumeSmoothDimension::XYZ)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, Radius, 1)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(ESupportedVoxelType, VoxTy, ESupportedVoxelType::None)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector3, Dimension, FIntVector::ZeroValue)
+    };
+    // Smooths on CPU with the same results as FVolumeSmoother on GPU, into voxels of the same
+    // type. Can be called from any thread.
+    static TOptional<FString> SmoothCPUData(const SmoothCPUDataDesc &Desc,
+                                            const VolumeCPUData &VolDat,
+                                            VolumeCPUData &SmoothedVolOut);
+
     static EPixelFormat GetVoxelPixelFormat(ESupportedVoxelType Type) {
         switch (Type) {
         case ESupportedVoxelType::UInt8:
             return PF_R8;
         case ESupportedVoxelType::UInt16:
-            return PF_R16_UINT;
+            // Normalized as PF_R8, so that shaders read and filter both alike
+            return PF_G16;
         case ESupportedVoxelType::Float32:
             return PF_R32_FLOAT;
         default:
@@ -101,6 +276,23 @@ class VolumeData {
         }
         return MakeTuple(0.f, 0.f, 1.f);
     }
+
+  private:
+    // Writes voxels into the buffer returned by AllocOut for the loaded dimension, which is called
+    // at most once on the calling thread. Voxels needing no transposition are aliased in AliasOut
+    // instead, if it is not nullptr and File is nullptr. Without File, the file is opened here.
+    static TVariant<FIntVector3, FString>
+    loadCPUDataFromFile(const LoadFromFileDesc &Desc, const OpenedFile *File,
+                        TFunctionRef<uint8 *(const FIntVector3 &)> AllocOut,
+                        VolumeCPUData *AliasOut, LoadFromFileState *State);
+    static TVariant<FIntVector3, FString>
+    loadCPUDataFromContainer(const LoadFromFileDesc &Desc, const FIntVector3 &ROIMax,
+                             const OpenedFile &File,
+                             TFunctionRef<uint8 *(const FIntVector3 &)> AllocOut,
+                             LoadFromFileState *State);
+    static UVolumeTexture *createTransientTexture(ESupportedVoxelType VoxTy,
+                                                  const FIntVector3 &Dimension,
+                                                  const FName &Name);
 };
 
 class TransferFunctionData {
@@ -37,6 +37,13 @@ class VIS4EARTH_API UGeoComponent : public USceneComponent {
     TOptional<GeoMesh> GenerateGeoMesh(int32 LongtitudeTessellation = 10,
                                        int32 LatitudeTessellation = 10);
 
+    // Voxel ROI [Min, Max) covered by the current ranges, in a volume of Dimension voxels which
+    // covers the full ranges
+    TTuple<FIntVector3, FIntVector3> GetVoxelROI(const FVector2D &FullLongtitudeRange,
+                                                 const FVector2D &FullLatitudeRange,
+                                                 const FVector2D &FullHeightRange,
+                                                 const FIntVector3 &Dimension) const;
+
     UUserWidget *GetUI() const { return ui.Get(); }
 
     UFUNCTION()
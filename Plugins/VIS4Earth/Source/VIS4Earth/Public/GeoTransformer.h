@@ -0,0 +1,65 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "CesiumGeoreference.h"
+
+/*
+ * Class: FGeoTransformer
+ * Function:
+ * -- Transforms positions on a grid spanning ranges of longtitude, latitude and height to Unreal
+ *    in batches, with the same results as ACesiumGeoreference within MaxError.
+ * -- Longtitudes and latitudes of grid lines are sined and cosined once, so that positions on
+ *    edges of the grid, e.g. vertices of isosurfaces, need trigonometry along one axis at most.
+ * -- Positions are lifted onto the WGS84 ellipsoid and then transformed by the ECEF-to-Unreal
+ *    matrix of the georeference with SIMD. If that fails validation against the georeference,
+ *    e.g. for georeferences on other ellipsoids, positions are transformed by it instead,
+ *    serially on the game thread.
+ * -- Normals are transformed by the cofactor matrix of the Jacobian of the transformation, so
+ *    that they keep facing the same side as cross products of transformed edges.
+ */
+class VIS4EARTH_API FGeoTransformer {
+  public:
+    // In centimeters, i.e. Unreal units
+    static constexpr double MaxError = 1.;
+
+    struct Parameters {
+        FVector2D LongtitudeRange;
+        FVector2D LatitudeRange;
+        FVector2D HeightRange;
+        // Of the grid in cells. Grid positions 0 and Dimension are on the minimums and maximums
+        // of the ranges respectively.
+        FIntVector3 Dimension;
+        TWeakObjectPtr<ACesiumGeoreference> GeoRef;
+    };
+    static TVariant<TSharedRef<FGeoTransformer>, FString> Create(const Parameters &Params);
+
+    bool IsOnWGS84() const { return isOnWGS84; }
+
+    // Reads the georeference if not on WGS84, which must then be called on the game thread
+    FVector Transform(const FVector &GridPos) const;
+    // In place. In parallel on WGS84, and serially otherwise.
+    void Transform(TArrayView<FVector> GridPositions) const;
+    // Returns the normalized normal in Unreal of GridNormal at GridPos
+    FVector TransformNormal(const FVector &GridPos, const FVector &GridNormal) const;
+    // In place, before GridPositions are transformed. In parallel on WGS84, and serially otherwise.
+    void TransformNormals(TArrayView<const FVector> GridPositions,
+                          TArrayView<FVector> GridNormals) const;
+
+  private:
+    // Of longtitudes and latitudes in radians, and heights in meters
+    FVector3d mins;
+    FVector3d deltas;
+    FMatrix ecefToUnreal;
+    // Sines and cosines of grid lines
+    TArray<FVector2D> lonSinCoss;
+    TArray<FVector2D> latSinCoss;
+    bool isOnWGS84 = true;
+    TWeakObjectPtr<ACesiumGeoreference> geoRef;
+
+    FGeoTransformer(const Parameters &Params);
+
+    FVector transformByGeoRef(const FVector &GridPos) const;
+};
@@ -3,8 +3,7 @@
 #pragma once
 
 #include <array>
-#include <set>
-#include <unordered_map>
+#include <atomic>
 
 #include "Components/WidgetComponent.h"
 #include "CoreMinimal.h"
@@ -21,6 +20,26 @@ enum class EMCCMeshSmoothType : uint8 {
     None = 0 UMETA(DisplayName = "None"),
     Laplacian UMETA(DisplayName = "Laplacian"),
     Curvature UMETA(DisplayName = "Curvature"),
+    Taubin UMETA(DisplayName = "Taubin"),
+};
+
+UENUM()
+enum class EMCCBackend : uint8 {
+    // Marches cells in bricks, skipping blocks not crossed by the isosurface and bricks unchanged
+    // since the last extraction
+    MarchingCubes = 0 UMETA(DisplayName = "Marching Cubes"),
+    // Marches rows of cells trimmed to edges crossed by the isosurface, into exactly sized arrays
+    FlyingEdges UMETA(DisplayName = "Flying Edges"),
+    // Places a vertex in each cell crossed by the isosurface, joined into quads without slivers
+    SurfaceNets UMETA(DisplayName = "Surface Nets"),
+};
+
+UENUM()
+enum class EMCCNormalType : uint8 {
+    // Of triangles averaged on vertices
+    Face = 0 UMETA(DisplayName = "Face"),
+    // Of the volume interpolated along edges, i.e. smooth across triangles
+    Gradient UMETA(DisplayName = "Gradient"),
 };
 
 /*
@@ -33,12 +52,44 @@ class VIS4EARTH_API AMCCActor : public AActor {
     GENERATED_BODY()
 
   public:
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    EMCCBackend Backend = EMCCBackend::MarchingCubes;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     bool UseLerp = true;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     bool UseSmoothedVolume = false;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     EMCCMeshSmoothType MeshSmoothType = EMCCMeshSmoothType::None;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "1", ClampMax = "1024"))
+    int32 MeshSmoothIterationNum = 1;
+    // In centimeters. Smoothing stops once no vertex moves farther in an iteration.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "0"))
+    float MeshSmoothConvergence = 0.f;
+    // Taubin smoothing shrinks by Lambda and then inflates by Mu, where Mu < -Lambda < 0
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "0", ClampMax = "1"))
+    float TaubinLambda = .5f;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "-1", ClampMax = "0"))
+    float TaubinMu = -.53f;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    EMCCNormalType NormalType = EMCCNormalType::Face;
+    // Precomputes gradients of the volume for Gradient normals, instead of sampling 6 voxels per
+    // corner of each cell with vertices
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    bool CacheVolumeGradient = true;
+    // Keeps this ratio of triangles of each brick by quadric-error edge collapse. 1 for none.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "0.01", ClampMax = "1"))
+    float DecimationRatio = 1.f;
+    // In voxels. Collapses moving the isosurface farther, in root mean square distance to the
+    // triangles around them, are skipped. 0 for no bound.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "0"))
+    float DecimationMaxError = 0.f;
+    // LOD 0 is the mesh, and each further LOD is decimated to a quarter of the previous one
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "1", ClampMax = "4"))
+    int32 LODNum = 1;
+    // In centimeters, from where LOD 1 is drawn instead of LOD 0. Each further LOD is drawn from
+    // twice the distance of the previous one.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth", meta = (ClampMin = "0"))
+    float LODDistance = 1000000.f;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     FIntVector2 HeightRange = {0, 0};
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
@@ -107,23 +158,132 @@ class VIS4EARTH_API AMCCActor : public AActor {
     TArray<FVector2D> uvs;
     TArray<int32> indices;
 
-    struct Edge {
-        std::array<int32, 2> VertIDs;
-        Edge(int32 V0, int32 V1) : VertIDs{V0, V1} {}
+    // In compressed sparse rows, where neighbors of vertex V are VertIDs[Offsets[V]] to
+    // VertIDs[Offsets[V + 1] - 1], and its triangles TriIDs[TriOffsets[V]] to
+    // TriIDs[TriOffsets[V + 1] - 1], both in ascending order
+    struct VertexAdjacency {
+        TArray<int32> Offsets;
+        TArray<int32> VertIDs;
+        TArray<int32> TriOffsets;
+        TArray<int32> TriIDs;
+
+        int32 GetNeighborNum(int32 VertID) const { return Offsets[VertID + 1] - Offsets[VertID]; }
+        TArrayView<const int32> GetNeighbors(int32 VertID) const {
+            return TArrayView<const int32>(VertIDs.GetData() + Offsets[VertID],
+                                           GetNeighborNum(VertID));
+        }
+        TArrayView<const int32> GetTriangles(int32 VertID) const {
+            return TArrayView<const int32>(TriIDs.GetData() + TriOffsets[VertID],
+                                           TriOffsets[VertID + 1] - TriOffsets[VertID]);
+        }
 
-        struct Less {
-            bool operator()(const Edge &E0, const Edge &E1) const {
-                return std::less<decltype(VertIDs)>()(E0.VertIDs, E1.VertIDs);
-            }
-        };
+        // Counting sort of triangles in Indices by their vertices, in parallel
+        void Build(const TArray<int32> &Indices, int32 VertNum);
     };
-    std::set<Edge, Edge::Less> edges;
+    VertexAdjacency adjacency;
+
+    // Cells are split into bricks of BrickSize^3 cells. Triangles of brick B are the ones from
+    // TriOffsets[B] to TriOffsets[B + 1] - 1 of the mesh, and its vertices VertIDs[VertOffsets[B]]
+    // to VertIDs[VertOffsets[B + 1] - 1] in ascending order, where B indexes BrickIDs of bricks
+    // with triangles in ascending order.
+    struct MeshBricks {
+        static constexpr int32 BrickSize = 32;
+
+        static FIntVector3 GetBrickNum(const FIntVector3 &VoxelPerVolume) {
+            FIntVector3 brickNum;
+            for (int32 i = 0; i < 3; ++i)
+                brickNum[i] =
+                    FMath::Max(FMath::DivideAndRoundUp(VoxelPerVolume[i] - 1, BrickSize), 1);
+            return brickNum;
+        }
+
+        TArray<int32> BrickIDs;
+        TArray<int32> TriOffsets;
+        TArray<int32> VertOffsets;
+        TArray<int32> VertIDs;
+
+        TArrayView<const int32> GetVertices(int32 BrickIdx) const {
+            return TArrayView<const int32>(VertIDs.GetData() + VertOffsets[BrickIdx],
+                                           VertOffsets[BrickIdx + 1] - VertOffsets[BrickIdx]);
+        }
+
+        // Sorts triangles in Indices by bricks of their centroids in GridPositions, stably
+        void Build(TArray<int32> &Indices, const TArray<FVector> &GridPositions,
+                   const FIntVector3 &VoxelPerVolume);
+    };
+    MeshBricks bricks;
+    // Each brick of each LOD is uploaded into its own component, keyed by (LOD, Brick ID), which
+    // the engine culls by its bounds and draw distances. Only sections whose hashes change are
+    // uploaded again, in place if their triangles do not change.
+    struct BrickSectionHashes {
+        std::array<uint64, 2> Topology = {0, 0};
+        std::array<uint64, 2> Content = {0, 0};
+    };
+    TMap<FIntPoint, BrickSectionHashes> brickSectionHashes;
+    UPROPERTY(Transient)
+    TMap<FIntPoint, TObjectPtr<UProceduralMeshComponent>> brickComponents;
+
+    // Extracted off the game thread, and committed to components of bricks on it. Only LOD 0 is
+    // smoothed, and the coarser ones are dropped once uploaded.
+    struct LODMesh {
+        TArray<FVector> Positions;
+        TArray<FVector> Normals;
+        TArray<FVector2D> UVs;
+        TArray<int32> Indices;
+        MeshBricks Bricks;
+    };
+    // Triangles marched from cells of a brick, with vertices numbered locally
+    struct BrickChunk {
+        TArray<FVector> Positions;
+        TArray<FVector> Normals;
+        TArray<FVector2D> UVs;
+        TArray<int32> Indices;
+        // Of vertices in ascending order, where the edge of kind K, i.e. along X, Y or Z, starting
+        // at voxel (X, Y, Z) has ID ((K * DimZ + Z) * DimY + Y) * DimX + X
+        TArray<int64> EdgeIDs;
+        // Of cells marched, clipped to the height range
+        FIntVector2 ZRange;
+        // Of voxels read by the marching, if they are in memory
+        TOptional<uint64> VoxelHash;
+        // Of voxels sampled, if all cells of the brick were
+        TOptional<FVector2f> VoxelRange;
+    };
+    // Chunks of the last committed extraction by Marching Cubes, reused by the next one for
+    // bricks whose chunks would not change
+    struct MarchedBricks {
+        ESupportedVoxelType VoxelType;
+        FIntVector3 Dimension;
+        bool UseLerp;
+        bool UseGradientNormal;
+        float IsoValue;
+        TWeakPtr<const VolumeCPUData> Volume;
+        TWeakPtr<FVolumeBrickCache> BrickCache;
+        // Indexed by brick IDs, nullptr for bricks out of the height range
+        TArray<TSharedPtr<const BrickChunk>> Chunks;
+    };
+    TSharedPtr<const MarchedBricks> marchedBricks;
+
+    struct Mesh : LODMesh {
+        VertexAdjacency Adjacency;
+        TArray<LODMesh> CoarseLODs;
+        // Set only by Marching Cubes
+        TSharedPtr<const MarchedBricks> Marched;
+    };
+    // Bumped by each call of marchingCube(). Extraction of an older generation is cancelled and
+    // its mesh is dropped. Shared with workers, which may outlive the actor.
+    TSharedRef<std::atomic<uint32>> marchingCubeGeneration = MakeShared<std::atomic<uint32>>(0);
+    // Holds the buffers replaced by the last commit, whose capacity the next extraction reuses
+    TSharedPtr<Mesh> spareMesh;
 
     void setupSignalsSlots();
     void checkAndCorrectParameters();
     void marchingCube();
+    void commitMesh(const TSharedRef<Mesh> &MeshToCommit);
     void updateMaterialInstanceDynamic();
     void emptyMesh();
+    void uploadBrickSections(int32 LOD, EMeshSectionIndex SectionIdx, const MeshBricks &Bricks,
+                             const TArray<FVector> &Positions, const TArray<FVector> &Normals,
+                             const TArray<FVector2D> &UVs, const TArray<int32> &Indices);
     void updateMesh();
     void generateSmoothedMeshThenUpdateMesh(bool ShouldReGen = false);
 
@@ -136,8 +296,15 @@ class VIS4EARTH_API AMCCActor : public AActor {
             return;
 
         auto name = PropChngedEv.MemberProperty->GetFName();
-        if (name == GET_MEMBER_NAME_CHECKED(AMCCActor, UseLerp) ||
+        if (name == GET_MEMBER_NAME_CHECKED(AMCCActor, Backend) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, UseLerp) ||
             name == GET_MEMBER_NAME_CHECKED(AMCCActor, UseSmoothedVolume) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, NormalType) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, CacheVolumeGradient) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, DecimationRatio) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, DecimationMaxError) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, LODNum) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, LODDistance) ||
             name == GET_MEMBER_NAME_CHECKED(AMCCActor, HeightRange) ||
             name == GET_MEMBER_NAME_CHECKED(AMCCActor, IsoValue)) {
             marchingCube();
@@ -147,6 +314,13 @@ class VIS4EARTH_API AMCCActor : public AActor {
             generateSmoothedMeshThenUpdateMesh();
             return;
         }
+        if (name == GET_MEMBER_NAME_CHECKED(AMCCActor, MeshSmoothIterationNum) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, MeshSmoothConvergence) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, TaubinLambda) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCCActor, TaubinMu)) {
+            generateSmoothedMeshThenUpdateMesh(true);
+            return;
+        }
     }
 #endif // WITH_EDITOR
 };
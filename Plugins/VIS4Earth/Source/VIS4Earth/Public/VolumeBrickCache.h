@@ -0,0 +1,183 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <array>
+
+#include "Async/Future.h"
+#include "CoreMinimal.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeBrickCache
+ * Function:
+ * -- Pages BrickSize^3 bricks of a volume in from its file on demand, for volumes larger than
+ *    memory. Bricks are read through the ROI loading of VolumeData from the file opened once.
+ * -- Keeps resident bricks within a memory budget by evicting the least recently used ones in
+ *    O(1). Evicted bricks still referenced by a sampler are released with the last reference.
+ * -- Bricks can be prefetched asynchronously. A brick queued for prefetching but not being loaded
+ *    yet is loaded by whichever of the fetch and the prefetch task comes first, so that threads of
+ *    the pool never wait for tasks queued behind them. Can be used from any thread.
+ * -- A brick failing to load marks the cache failed. Its voxels read as 0, so that results
+ *    sampled from a failed cache must be discarded by checking GetLoadError.
+ */
+class VIS4EARTH_API FVolumeBrickCache : public TSharedFromThis<FVolumeBrickCache> {
+  public:
+    struct Parameters {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, BrickSize, 64)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int64, MemoryBudget, static_cast<int64>(4) << 30)
+        // The whole volume to page from. ROI fields are ignored.
+        // Containers are paged with their own brick size.
+        VolumeData::LoadFromFileDesc Desc;
+    };
+    static TVariant<TSharedRef<FVolumeBrickCache>, FString> Create(const Parameters &Params);
+
+    // In the transposed volume
+    const FIntVector3 &GetDimension() const { return dimension; }
+    ESupportedVoxelType GetVoxelType() const { return desc.VoxTy; }
+    int32 GetBrickSize() const { return brickSize; }
+    int64 GetResidentSize() const;
+    // Of the first brick failing to load, which is not retried
+    TOptional<FString> GetLoadError() const;
+
+    FIntVector3 GetBrickCoord(const FIntVector3 &Pos) const { return Pos / brickSize; }
+    // Voxel range [Min, Max) of a brick. Bricks on the far borders are clipped.
+    TTuple<FIntVector3, FIntVector3> GetBrickVoxelRange(const FIntVector3 &BrickCoord) const {
+        auto min = BrickCoord * brickSize;
+        return MakeTuple(min, FIntVector3(std::min(min.X + brickSize, dimension.X),
+                                          std::min(min.Y + brickSize, dimension.Y),
+                                          std::min(min.Z + brickSize, dimension.Z)));
+    }
+
+    // Returns the brick, loading it on this thread on a miss or if its prefetch has not started.
+    // Only waits for loads running on other threads. Returns nullptr if loading failed.
+    TSharedPtr<const VolumeCPUData> FetchBrick(const FIntVector3 &BrickCoord);
+    // Loads bricks covering voxels in [VoxelMin, VoxelMax) in the thread pool
+    void PrefetchBricks(const FIntVector3 &VoxelMin, const FIntVector3 &VoxelMax);
+
+    template <SupportedVoxelType T> T Sample(const FIntVector3 &Pos) {
+        auto brickCoord = GetBrickCoord(Pos);
+        auto brick = FetchBrick(brickCoord);
+        if (!brick.IsValid())
+            return T(0);
+
+        auto [min, max] = GetBrickVoxelRange(brickCoord);
+        auto local = Pos - min;
+        auto brickDim = max - min;
+        return reinterpret_cast<const T *>(
+            brick->GetData())[(static_cast<int64>(local.Z) * brickDim.Y + local.Y) * brickDim.X +
+                              local.X];
+    }
+
+  private:
+    using BrickFuture = TSharedFuture<TSharedPtr<const VolumeCPUData>>;
+    using BrickPromise = TPromise<TSharedPtr<const VolumeCPUData>>;
+    struct Entry {
+        BrickFuture Brick;
+        // Of a brick queued for prefetching, until a thread claims it to load the brick
+        TSharedPtr<BrickPromise> QueuedPromise;
+        // Zero until the brick is resident
+        int64 Size = 0;
+        // Neighbors in the list of resident bricks, from the least to the most recently used one
+        int32 Prev = INDEX_NONE;
+        int32 Next = INDEX_NONE;
+    };
+
+    int32 brickSize;
+    int64 memoryBudget;
+    int64 residentSize = 0;
+    TOptional<FString> loadError;
+    FIntVector3 dimension;
+    FIntVector3 brickNum;
+    VolumeData::LoadFromFileDesc desc;
+    TSharedRef<const VolumeData::OpenedFile> file;
+
+    mutable FCriticalSection mutex;
+    TMap<int32, Entry> entries;
+    int32 lruHead = INDEX_NONE;
+    int32 lruTail = INDEX_NONE;
+
+    FVolumeBrickCache(const Parameters &Params, const FIntVector3 &Dimension,
+                      const TSharedRef<const VolumeData::OpenedFile> &File);
+
+    int32 getBrickIndex(const FIntVector3 &BrickCoord) const {
+        return (BrickCoord.Z * brickNum.Y + BrickCoord.Y) * brickNum.X + BrickCoord.X;
+    }
+    // Returns the future of the brick, and a promise to fulfill if the caller should load it
+    TTuple<BrickFuture, TSharedPtr<BrickPromise>> acquire(const FIntVector3 &BrickCoord);
+    // Registers the brick as queued for prefetching. Returns false if it is already registered.
+    bool enqueue(const FIntVector3 &BrickCoord);
+    // Returns the promise of the brick if it is still queued, claiming it for the caller to load
+    TSharedPtr<BrickPromise> claim(const FIntVector3 &BrickCoord);
+    void load(const FIntVector3 &BrickCoord, BrickPromise &Promise);
+    void evict(int32 KeptBrickIndex);
+    // Called with mutex locked
+    void linkAsMostRecentlyUsed(int32 BrickIndex, Entry &BrickEntry);
+    void unlink(Entry &BrickEntry);
+};
+
+/*
+ * Class: FVolumeSampler
+ * Function:
+ * -- Samples voxels of a volume either kept as a whole in memory or paged by FVolumeBrickCache.
+ * -- Keeps the last fetched brick of each parity along X, Y and Z, so that cells across brick
+ *    borders never fetch their own corners twice.
+ * -- Keeps voxels in memory alive while sampling them, so that it can outlive their owner.
+ * -- Not thread-safe. Create one per thread.
+ */
+class VIS4EARTH_API FVolumeSampler {
+  public:
+    FVolumeSampler(const TSharedPtr<const VolumeCPUData> &Volume, const FIntVector3 &Dimension)
+        : data(Volume.IsValid() ? Volume->GetData() : nullptr), dimension(Dimension),
+          volume(Volume) {}
+    FVolumeSampler(const TSharedRef<FVolumeBrickCache> &Cache)
+        : dimension(Cache->GetDimension()), cache(Cache) {}
+
+    bool IsPaged() const { return cache.IsValid(); }
+    const TSharedPtr<const VolumeCPUData> &GetVolume() const { return volume; }
+    const TSharedPtr<FVolumeBrickCache> &GetBrickCache() const { return cache; }
+    // Set once a brick failed to load, after which sampled results must be discarded
+    TOptional<FString> GetLoadError() const {
+        return cache.IsValid() ? cache->GetLoadError() : TOptional<FString>();
+    }
+
+    template <SupportedVoxelType T> T Sample(const FIntVector3 &Pos) {
+        if (!cache.IsValid())
+            return reinterpret_cast<const T *>(
+                data)[(static_cast<int64>(Pos.Z) * dimension.Y + Pos.Y) * dimension.X + Pos.X];
+
+        auto brickCoord = cache->GetBrickCoord(Pos);
+        auto &slot = slots[(brickCoord.X & 0b1) | ((brickCoord.Y & 0b1) << 1) |
+                           ((brickCoord.Z & 0b1) << 2)];
+        if (slot.BrickCoord != brickCoord) {
+            auto [min, max] = cache->GetBrickVoxelRange(brickCoord);
+            slot.BrickCoord = brickCoord;
+            slot.Min = min;
+            slot.Dimension = max - min;
+            slot.Brick = cache->FetchBrick(brickCoord);
+        }
+        if (!slot.Brick.IsValid())
+            return T(0);
+
+        auto local = Pos - slot.Min;
+        return reinterpret_cast<const T *>(
+            slot.Brick->GetData())[(static_cast<int64>(local.Z) * slot.Dimension.Y + local.Y) *
+                                       slot.Dimension.X +
+                                   local.X];
+    }
+
+  private:
+    struct Slot {
+        FIntVector3 BrickCoord = {-1, -1, -1};
+        FIntVector3 Min;
+        FIntVector3 Dimension;
+        TSharedPtr<const VolumeCPUData> Brick;
+    };
+
+    const uint8 *data = nullptr;
+    FIntVector3 dimension;
+    TSharedPtr<const VolumeCPUData> volume;
+    TSharedPtr<FVolumeBrickCache> cache;
+    std::array<Slot, 8> slots;
+};
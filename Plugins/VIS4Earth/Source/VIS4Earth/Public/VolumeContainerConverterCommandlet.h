@@ -0,0 +1,26 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include "Commandlets/Commandlet.h"
+#include "CoreMinimal.h"
+
+#include "VolumeContainerConverterCommandlet.generated.h"
+
+/*
+ * Class: UVolumeContainerConverterCommandlet
+ * Function:
+ * -- Converts a RAW volume into a bricked volume container without the editor UI.
+ * -- Usage: UnrealEditor-Cmd <Project> -run=VolumeContainerConverter -Src=<RAW> -Dst=<Container>
+ *    -VoxTy=<UInt8|UInt16|Float32> -Dim=<X,Y,Z> [-Axis=<X,Y,Z>] [-BrickSize=<N>]
+ *    [-Compression=<Oodle|Zlib|...>] [-Lon=<Min,Max>] [-Lat=<Min,Max>] [-Height=<Min,Max>]
+ */
+UCLASS()
+class VIS4EARTH_API UVolumeContainerConverterCommandlet : public UCommandlet {
+    GENERATED_BODY()
+
+  public:
+    UVolumeContainerConverterCommandlet();
+
+    int32 Main(const FString &Params) override;
+};
@@ -4,11 +4,16 @@
 
 #include "Components/ActorComponent.h"
 #include "Components/WidgetComponent.h"
+#include "Containers/Ticker.h"
 #include "CoreMinimal.h"
 
 #include "CesiumGeoreference.h"
 
 #include "Data.h"
+#include "GeoRenderer.h"
+#include "VolumeBrickCache.h"
+#include "VolumeGradient.h"
+#include "VolumeMinMaxTree.h"
 
 #include "VolumeDataComponent.generated.h"
 
@@ -21,12 +26,59 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
     EVolumeSmoothType VolumeSmoothType = EVolumeSmoothType::Max;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth|Smooth")
     EVolumeSmoothDimension VolumeSmoothDimension = EVolumeSmoothDimension::XYZ;
+    // Larger radii are smoothed on CPU whenever the volume is kept in CPU, where max and min cost
+    // O(1) per voxel instead of O(VolumeSmoothRadius) on GPU
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Smooth", meta = (ClampMin = "0", ClampMax = "32"))
+    int32 VolumeSmoothRadius = VolumeData::SmoothCPUDataDesc::DefRadius;
+    // Settings of RAW volumes. Containers are imported with the voxel type, dimension and
+    // geographic ranges in their headers instead, leaving these and the ranges below unchanged
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     ESupportedVoxelType ImportVoxelType = VolumeData::LoadFromFileDesc::DefVoxTy;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     FIntVector ImportVolumeTransformedAxis = VolumeData::LoadFromFileDesc::DefAxis;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     FIntVector ImportVolumeDimension = VolumeData::LoadFromFileDesc::DefDimension;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    FIntVector ImportROIMin = VolumeData::LoadFromFileDesc::DefROIMin;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    FIntVector ImportROIMax = VolumeData::LoadFromFileDesc::DefROIMax;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    FIntVector ImportROIStride = VolumeData::LoadFromFileDesc::DefROIStride;
+    // Derive the ROI from ranges of the UGeoComponent of the owner in place of ImportROIMin and
+    // ImportROIMax, which are left unchanged. The ranges should lie in the full ranges of the RAW
+    // volume below
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    bool DeriveImportROIFromGeographics = false;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    FVector2D ImportVolumeLongtitudeRange = FGeoRenderer::GeoParameters::DefLongtitudeRange;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    FVector2D ImportVolumeLatitudeRange = FGeoRenderer::GeoParameters::DefLatitudeRange;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|ROI")
+    FVector2D ImportVolumeHeightRange = FGeoRenderer::GeoParameters::DefHeightRange;
+    // Page bricks of the volume in on demand instead of importing it as a whole, for volumes
+    // larger than memory. No VolumeTexture is created and ROI fields are ignored.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Paging")
+    bool PageVolume = false;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Paging")
+    int32 PagedBrickSize = FVolumeBrickCache::Parameters::DefBrickSize;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Paging")
+    int32 PagedMemoryBudgetMB =
+        static_cast<int32>(FVolumeBrickCache::Parameters::DefMemoryBudget >> 20);
+    // Files of all time steps, e.g. D:/Ocean/T_*.raw. Empty to pick files in a dialog instead.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|TimeSeries")
+    FString TimeSeriesFilePattern;
+    // Number of steps after the current one decoded in the background. For smooth playback, it
+    // should be at least GetAverageTimeStepLoadLatency() * TimeSeriesStepsPerSecond.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|TimeSeries")
+    int32 TimeSeriesPrefetchDepth = 4;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|TimeSeries")
+    float TimeSeriesStepsPerSecond = 30.f;
+    // Ring buffer of decoded time steps
+    UPROPERTY(VisibleAnywhere, Transient, Category = "VIS4Earth|TimeSeries")
+    TArray<TObjectPtr<UVolumeTexture>> TimeSeriesTextures;
+    // Time steps in TimeSeriesTextures smoothed on CPU when loaded, or nullptr
+    UPROPERTY(VisibleAnywhere, Transient, Category = "VIS4Earth|TimeSeries")
+    TArray<TObjectPtr<UVolumeTexture>> TimeSeriesTexturesSmoothed;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
     TObjectPtr<UVolumeTexture> VolumeTexture;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
@@ -51,6 +103,12 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
 
     UFUNCTION(CallInEditor, Category = "VIS4Earth")
     void LoadRAWVolume();
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|TimeSeries")
+    void LoadTimeSeries();
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|TimeSeries")
+    void PlayTimeSeries();
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|TimeSeries")
+    void PauseTimeSeries();
     UFUNCTION(CallInEditor, Category = "VIS4Earth")
     void LoadTF();
     UFUNCTION(CallInEditor, Category = "VIS4Earth")
@@ -59,15 +117,42 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
     void SyncTFCurveTexture();
 
     DECLARE_MULTICAST_DELEGATE_OneParam(FOnVolumeDataChanged, UVolumeDataComponent *);
+    DECLARE_MULTICAST_DELEGATE_TwoParams(FOnVolumeImportProgressed, UVolumeDataComponent *,
+                                         float);
+    DECLARE_MULTICAST_DELEGATE_ThreeParams(FOnTimeStepLoaded, UVolumeDataComponent *, int32,
+                                           double);
     DECLARE_MULTICAST_DELEGATE_OneParam(FOnTransferFunctionDataChanged, UVolumeDataComponent *);
 
     FOnVolumeDataChanged OnVolumeDataChanged;
+    FOnVolumeImportProgressed OnVolumeImportProgressed;
+    // Broadcasts the step and its load latency in seconds
+    FOnTimeStepLoaded OnTimeStepLoaded;
     FOnTransferFunctionDataChanged OnTransferFunctionDataChanged;
 
     UVolumeDataComponent();
 
     UUserWidget *GetUI() const { return ui.Get(); }
 
+    bool IsImportingVolume() const { return importState.IsValid(); }
+    float GetVolumeImportProgress() const {
+        return importState.IsValid() ? importState->Progress.load() : 1.f;
+    }
+    void CancelVolumeImport();
+
+    // Files are ordered by time steps and imported with the same import parameters
+    void SetTimeSeries(const TArray<FString> &FilePaths);
+    // Shows the step once it is decoded. Steps wrap around. Steps failing to load are skipped
+    // by playback and not loaded again until the time series is set again.
+    void SetTimeStep(int32 Step);
+    int32 GetTimeStep() const { return timeStep; }
+    int32 GetTimeStepNum() const { return timeSeriesFiles.Num(); }
+    bool IsPlayingTimeSeries() const { return timeSeriesPlaybackTicker.IsValid(); }
+    // Seconds from reading to staging a step, or negative if it has not been loaded
+    double GetTimeStepLoadLatency(int32 Step) const {
+        return timeStepLoadLatencies.IsValidIndex(Step) ? timeStepLoadLatencies[Step] : -1.;
+    }
+    double GetAverageTimeStepLoadLatency() const;
+
     void SetKeepVolumeInCPU(bool Keep) {
         keepVolumeInCPU = Keep;
         generateSmoothedVolume();
@@ -76,17 +161,51 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
         keepSmoothedVolume = Keep;
         generateSmoothedVolume();
     }
+    // Precomputes gradients of voxels kept in CPU, which take 12 bytes per voxel
+    void SetKeepVolumeGradient(bool Keep);
 
-    const TArray<uint8> &GetVolumeCPUData() const { return volumeCPUData; }
+    bool HasVolume() const { return VolumeTexture || volumeBrickCache.IsValid(); }
+    bool IsVolumePaged() const { return volumeBrickCache.IsValid(); }
+    const TSharedPtr<FVolumeBrickCache> &GetVolumeBrickCache() const { return volumeBrickCache; }
+    // Shared with samplers, so that replacing voxels never frees them under a reader
+    const TSharedPtr<const VolumeCPUData> &GetVolumeCPUData() const { return volumeCPUData; }
+    const TSharedPtr<const VolumeCPUData> &GetVolumeCPUDataSmoothed() const {
+        return volumeCPUDataSmoothed;
+    }
+    // Of the volume and the smoothed one kept in CPU, or nullptr if they are not kept
+    const TSharedPtr<const FVolumeMinMaxTree> &GetVolumeMinMaxTree() const {
+        return volumeMinMaxTree;
+    }
+    const TSharedPtr<const FVolumeMinMaxTree> &GetVolumeMinMaxTreeSmoothed() const {
+        return volumeMinMaxTreeSmoothed;
+    }
+    // Of the volume and the smoothed one kept in CPU, or nullptr if they are not kept
+    const TSharedPtr<const FVolumeGradient> &GetVolumeGradient() const { return volumeGradient; }
+    const TSharedPtr<const FVolumeGradient> &GetVolumeGradientSmoothed() const {
+        return volumeGradientSmoothed;
+    }
     ESupportedVoxelType GetVolumeVoxelType() const { return prevVolumeDataDesc.VoxTy; }
     FIntVector GetVoxelPerVolume() const { return prevVolumeDataDesc.Dimension; }
 
+    // Samples from the brick cache when paged, whose GetLoadError tells if results are valid.
+    // Prefer a FVolumeSampler for many samples.
     template <SupportedVoxelType T> T SampleVolumeCPUData(const FIntVector3 &Pos) {
-        return *(reinterpret_cast<const T *>(volumeCPUData.GetData()) + Pos.Z * voxPerVolYxX +
+        if (volumeBrickCache.IsValid())
+            return volumeBrickCache->Sample<T>(Pos);
+        return *(reinterpret_cast<const T *>(volumeCPUData->GetData()) + Pos.Z * voxPerVolYxX +
                  Pos.Y * VolumeTexture->GetSizeX() + Pos.X);
     }
-    float SampleVolumeCPUDataSmoothed(const FIntVector3 &Pos) {
-        return *(reinterpret_cast<const float *>(volumeCPUDataSmoothed.GetData()) +
+    FVolumeSampler CreateVolumeSampler() const {
+        return volumeBrickCache.IsValid()
+                   ? FVolumeSampler(volumeBrickCache.ToSharedRef())
+                   : FVolumeSampler(volumeCPUData, prevVolumeDataDesc.Dimension);
+    }
+    FVolumeSampler CreateVolumeSamplerSmoothed() const {
+        return FVolumeSampler(volumeCPUDataSmoothed, prevVolumeDataDesc.Dimension);
+    }
+    // Smoothed voxels keep the voxel type of the volume
+    template <SupportedVoxelType T> T SampleVolumeCPUDataSmoothed(const FIntVector3 &Pos) {
+        return *(reinterpret_cast<const T *>(volumeCPUDataSmoothed->GetData()) +
                  Pos.Z * voxPerVolYxX + Pos.Y * VolumeTexture->GetSizeX() + Pos.X);
     }
 
@@ -102,15 +221,106 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
     size_t voxPerVolYxX;
     bool keepVolumeInCPU = false;
     bool keepSmoothedVolume = false;
+    bool keepVolumeGradient = false;
+    // Bumped on the game thread whenever smoothing is superseded, so that stale results are dropped
+    uint32 smoothGeneration = 0;
     VolumeData::LoadFromFileDesc prevVolumeDataDesc;
 
+    TSharedPtr<VolumeData::LoadFromFileState> importState;
+    FTSTicker::FDelegateHandle importProgressTicker;
+
+    // Settings of deriving data from voxels, taken on the game thread for workers
+    struct DeriveParameters {
+        ESupportedVoxelType VoxTy;
+        FIntVector3 Dimension;
+        bool KeepVolumeInCPU;
+        bool KeepVolumeGradient;
+        bool KeepSmoothedVolume;
+        // Otherwise smoothed on GPU from the volume texture
+        bool SmoothOnCPU;
+        EVolumeSmoothType SmoothType;
+        EVolumeSmoothDimension SmoothDimension;
+        int32 SmoothRadius;
+
+        bool operator==(const DeriveParameters &) const = default;
+    };
+    // Derived from voxels on workers, so that the game thread only swaps them in
+    struct DerivedVolumeData {
+        TSharedPtr<const VolumeCPUData> CPUData;
+        TSharedPtr<const FVolumeMinMaxTree> MinMaxTree;
+        TSharedPtr<const FVolumeGradient> Gradient;
+    };
+
+    struct TimeStepSlot {
+        int32 Step = -1;
+        bool Ready = false;
+        FIntVector3 Dimension;
+        TSharedPtr<VolumeData::LoadFromFileState> State;
+        // Derived when the step is loaded, so that showing it only swaps them in
+        DeriveParameters Params = {};
+        DerivedVolumeData Derived;
+        DerivedVolumeData DerivedSmoothed;
+    };
+    int32 timeStep = -1;
+    int32 pendingTimeStep = -1;
+    int32 shownTimeStepSlotIdx = INDEX_NONE;
+    VolumeData::LoadFromFileDesc timeSeriesDesc;
+    TArray<FString> timeSeriesFiles;
+    TArray<TimeStepSlot> timeStepSlots;
+    TArray<double> timeStepLoadLatencies;
+    TBitArray<> failedTimeSteps;
+    FTSTicker::FDelegateHandle timeSeriesPlaybackTicker;
+
     TObjectPtr<UUserWidget> ui;
 
-    TArray<uint8> volumeCPUData;
-    TArray<float> volumeCPUDataSmoothed;
+    TSharedPtr<const VolumeCPUData> volumeCPUData;
+    TSharedPtr<FVolumeBrickCache> volumeBrickCache;
+    TSharedPtr<const VolumeCPUData> volumeCPUDataSmoothed;
+    TSharedPtr<const FVolumeMinMaxTree> volumeMinMaxTree;
+    TSharedPtr<const FVolumeMinMaxTree> volumeMinMaxTreeSmoothed;
+    TSharedPtr<const FVolumeGradient> volumeGradient;
+    TSharedPtr<const FVolumeGradient> volumeGradientSmoothed;
     TMap<float, FVector4f> tfPnts;
 
+    TOptional<VolumeData::LoadFromFileDesc> makeImportDesc(const FString &FilePath);
+    void importRAWVolume(const VolumeData::LoadFromFileDesc &Desc);
+    void endVolumeImport();
+    void pageVolume(const VolumeData::LoadFromFileDesc &Desc);
+    void onRAWVolumeImported(const VolumeData::LoadFromFileDesc &Desc,
+                             const DeriveParameters &Params, const DerivedVolumeData &Derived,
+                             const DerivedVolumeData &DerivedSmoothed);
+    void clearTimeSeries();
+    void prefetchTimeSteps();
+    void loadTimeStep(int32 SlotIdx, int32 Step);
+    void onTimeStepLoaded(int32 SlotIdx, const TSharedPtr<VolumeData::LoadFromFileState> &State,
+                          const TVariant<FIntVector3, FString> &Ret,
+                          const DeriveParameters &Params, const DerivedVolumeData &Derived,
+                          const DerivedVolumeData &DerivedSmoothed, double StartTime);
+    void showTimeStep(int32 SlotIdx);
     void generateSmoothedVolume();
+    void onVolumeSmoothed(const DeriveParameters &Params,
+                          const TVariant<DerivedVolumeData, FString> &Ret);
+    DeriveParameters makeDeriveParameters(ESupportedVoxelType VoxTy,
+                                          const FIntVector3 &Dimension) const;
+    void applyDerivedVolumeData(const DerivedVolumeData &Derived);
+    void applyDerivedSmoothedVolumeData(const DeriveParameters &Params,
+                                        const DerivedVolumeData &DerivedSmoothed);
+    // Takes the smoothed volume derived along with the volume if it is derived with the current
+    // settings, or smooths the volume again otherwise
+    void takeOrGenerateSmoothedVolume(const DeriveParameters &Params,
+                                      UVolumeTexture *TextureSmoothed,
+                                      const DerivedVolumeData &DerivedSmoothed);
+    // Can be called from any thread
+    static DerivedVolumeData deriveVolumeData(const DeriveParameters &Params,
+                                              const TSharedPtr<const VolumeCPUData> &VolDat);
+    static TVariant<DerivedVolumeData, FString>
+    deriveSmoothedVolumeData(const DeriveParameters &Params, const VolumeCPUData &VolDat);
+    static TSharedPtr<const FVolumeMinMaxTree>
+    createVolumeMinMaxTree(const DeriveParameters &Params,
+                           const TSharedPtr<const VolumeCPUData> &VolDat);
+    static TSharedPtr<const FVolumeGradient>
+    createVolumeGradient(const DeriveParameters &Params,
+                         const TSharedPtr<const VolumeCPUData> &VolDat);
     void generatePreIntegratedTF();
     void createDefaultTFTexture();
 
@@ -126,10 +336,22 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
 
         auto name = PropChngedEv.MemberProperty->GetFName();
         if (name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothType) ||
-            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothDimension)) {
+            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothDimension) ||
+            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothRadius)) {
             generateSmoothedVolume();
             return;
         }
+        if (name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, TimeSeriesPrefetchDepth) &&
+            !timeSeriesFiles.IsEmpty()) {
+            auto files = timeSeriesFiles;
+            SetTimeSeries(files);
+            return;
+        }
+        if (name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, TimeSeriesStepsPerSecond) &&
+            IsPlayingTimeSeries()) {
+            PlayTimeSeries();
+            return;
+        }
     }
 #endif // WITH_EDITOR
 };
@@ -0,0 +1,58 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Data.h"
+#include "VolumeBrickCache.h"
+
+/*
+ * Class: FVolumeGradient
+ * Function:
+ * -- Keeps the gradients of all voxels of a volume, in voxels per voxel, which take 12 bytes
+ *    per voxel.
+ * -- Gradients are central differences, or one-sided ones on borders of the volume. Rows of
+ *    voxels are differenced 4 voxels at a time with SIMD.
+ * -- Sample() computes the same gradient of a single voxel without keeping the volume.
+ */
+class VIS4EARTH_API FVolumeGradient {
+  public:
+    struct Parameters {
+        ESupportedVoxelType VoxelType;
+        FIntVector3 Dimension;
+        const uint8 *Data;
+    };
+    // Returns nullptr if Params is invalid
+    static TSharedPtr<const FVolumeGradient> Create(const Parameters &Params);
+
+    const FIntVector3 &GetDimension() const { return dimension; }
+    const FVector3f &Get(const FIntVector3 &Pos) const {
+        return gradients[(static_cast<int64>(Pos.Z) * dimension.Y + Pos.Y) * dimension.X + Pos.X];
+    }
+
+    template <SupportedVoxelType T>
+    static FVector3f Sample(FVolumeSampler &Sampler, const FIntVector3 &Pos,
+                            const FIntVector3 &Dimension) {
+        FVector3f gradient;
+        for (int32 i = 0; i < 3; ++i) {
+            auto prev = Pos;
+            auto next = Pos;
+            prev[i] = std::max(Pos[i] - 1, 0);
+            next[i] = std::min(Pos[i] + 1, Dimension[i] - 1);
+            gradient[i] = next[i] == prev[i] ? 0.f
+                                             : (static_cast<float>(Sampler.Sample<T>(next)) -
+                                                static_cast<float>(Sampler.Sample<T>(prev))) /
+                                                   (next[i] - prev[i]);
+        }
+        return gradient;
+    }
+
+  private:
+    FIntVector3 dimension;
+    TArray64<FVector3f> gradients;
+
+    FVolumeGradient() = default;
+
+    template <SupportedVoxelType T> void build(const Parameters &Params);
+};
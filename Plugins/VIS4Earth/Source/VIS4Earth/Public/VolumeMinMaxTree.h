@@ -0,0 +1,151 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeMinMaxTree
+ * Function:
+ * -- Keeps the value ranges of BlockSize^3 blocks of a volume, and of 2^3 nodes of the level
+ *    below on each level above, up to a single root.
+ * -- Block B covers cells starting at voxels in [B * BlockSize, (B + 1) * BlockSize), whose
+ *    corners are voxels in [B * BlockSize, (B + 1) * BlockSize] clamped to the volume.
+ * -- Finds blocks crossed by an isosurface by descending only into nodes crossed by it, so that
+ *    isosurface extraction skips the empty space of the volume.
+ * -- Also indexes the ranges of blocks on each layer of blocks along Z with an interval tree, so
+ *    that blocks of a layer crossed by any isovalue are found in time linear to their number.
+ */
+class VIS4EARTH_API FVolumeMinMaxTree {
+  public:
+    static constexpr int32 BlockSize = 8;
+
+    struct Parameters {
+        ESupportedVoxelType VoxelType;
+        FIntVector3 Dimension;
+        const uint8 *Data;
+    };
+    // Returns nullptr if Params is invalid
+    static TSharedPtr<const FVolumeMinMaxTree> Create(const Parameters &Params);
+
+    const FIntVector3 &GetBlockNum() const { return levels[0].Dimension; }
+    FIntVector3 GetBlockCoord(const FIntVector3 &Pos) const { return Pos / BlockSize; }
+
+    // The same test as marching cubes and squares, where voxels not less than IsoValue are inside
+    static bool IsCrossed(const FVector2f &Range, float IsoValue) {
+        return Range.X < IsoValue && Range.Y >= IsoValue;
+    }
+
+    // Calls Func(BlockCoord) on each block crossed by IsoValue with any cell starting at voxels
+    // in [PosMin, PosMax). Blocks are visited depth first, i.e. not in the order of the volume.
+    template <typename FuncTy>
+    void ForEachActiveBlock(float IsoValue, const FIntVector3 &PosMin, const FIntVector3 &PosMax,
+                            FuncTy &&Func) const {
+        FIntVector3 blockMin = GetBlockCoord(PosMin);
+        FIntVector3 blockMax(FMath::DivideAndRoundUp(PosMax.X, BlockSize),
+                             FMath::DivideAndRoundUp(PosMax.Y, BlockSize),
+                             FMath::DivideAndRoundUp(PosMax.Z, BlockSize));
+        for (int32 i = 0; i < 3; ++i) {
+            blockMin[i] = std::max(blockMin[i], 0);
+            blockMax[i] = std::min(blockMax[i], GetBlockNum()[i]);
+            if (blockMin[i] >= blockMax[i])
+                return;
+        }
+
+        auto visit = [&](auto &&visit, int32 Lvl, const FIntVector3 &Coord) -> void {
+            auto &level = levels[Lvl];
+            if (!IsCrossed(level.Ranges[level.GetIndex(Coord)], IsoValue))
+                return;
+            if (Lvl == 0) {
+                Func(Coord);
+                return;
+            }
+
+            FIntVector3 child;
+            for (child.Z = Coord.Z * 2; child.Z < Coord.Z * 2 + 2; ++child.Z)
+                for (child.Y = Coord.Y * 2; child.Y < Coord.Y * 2 + 2; ++child.Y)
+                    for (child.X = Coord.X * 2; child.X < Coord.X * 2 + 2; ++child.X) {
+                        auto &lower = levels[Lvl - 1];
+                        // Covering blocks in [child, child + 1) * 2^(Lvl - 1) on level 0
+                        auto isOverlapped = [&](int32 Axis) {
+                            return child[Axis] < lower.Dimension[Axis] &&
+                                   (child[Axis] + 1) << (Lvl - 1) > blockMin[Axis] &&
+                                   child[Axis] << (Lvl - 1) < blockMax[Axis];
+                        };
+                        if (isOverlapped(0) && isOverlapped(1) && isOverlapped(2))
+                            visit(visit, Lvl - 1, child);
+                    }
+        };
+        visit(visit, levels.Num() - 1, FIntVector3::ZeroValue);
+    }
+
+    // Calls Func(BlockCoord) on each block on layer BlockZ crossed by IsoValue, in no spatial
+    // order. Costs O(log(N) + K) for N blocks on the layer, K of which are crossed.
+    template <typename FuncTy>
+    void ForEachActiveBlockOnLayer(float IsoValue, int32 BlockZ, FuncTy &&Func) const {
+        if (BlockZ < 0 || BlockZ >= GetBlockNum().Z)
+            return;
+
+        auto &layer = layers[BlockZ];
+        auto toBlockCoord = [&](int32 BlockIdx) {
+            return FIntVector3(BlockIdx % GetBlockNum().X, BlockIdx / GetBlockNum().X, BlockZ);
+        };
+        auto nodeIdx = layer.Nodes.IsEmpty() ? INDEX_NONE : 0;
+        while (nodeIdx != INDEX_NONE) {
+            auto &node = layer.Nodes[nodeIdx];
+            // Intervals of the node contain its center, thus the isovalue from one of their ends
+            if (IsoValue <= node.Center) {
+                for (auto i = node.Start; i < node.End && layer.ByMin[i].Range.X < IsoValue; ++i)
+                    Func(toBlockCoord(layer.ByMin[i].BlockIdx));
+                nodeIdx = IsoValue < node.Center ? node.Left : INDEX_NONE;
+            } else {
+                for (auto i = node.Start; i < node.End && layer.ByMax[i].Range.Y >= IsoValue; ++i)
+                    Func(toBlockCoord(layer.ByMax[i].BlockIdx));
+                nodeIdx = node.Right;
+            }
+        }
+    }
+
+  private:
+    struct Level {
+        FIntVector3 Dimension;
+        // Minimum and maximum voxels of nodes
+        TArray<FVector2f> Ranges;
+
+        int32 GetIndex(const FIntVector3 &Coord) const {
+            return (Coord.Z * Dimension.Y + Coord.Y) * Dimension.X + Coord.X;
+        }
+    };
+    TArray<Level> levels;
+
+    struct Interval {
+        FVector2f Range;
+        // Of the block on its layer
+        int32 BlockIdx;
+    };
+    struct IntervalNode {
+        // Intervals in [Start, End) contain Center. Those of Left and Right end below and start
+        // above it respectively.
+        float Center;
+        int32 Left = INDEX_NONE;
+        int32 Right = INDEX_NONE;
+        int32 Start;
+        int32 End;
+    };
+    struct IntervalTree {
+        // Root at 0
+        TArray<IntervalNode> Nodes;
+        // Intervals of nodes in ascending order of minimums and descending order of maximums
+        TArray<Interval> ByMin;
+        TArray<Interval> ByMax;
+    };
+    TArray<IntervalTree> layers;
+
+    FVolumeMinMaxTree() = default;
+
+    template <SupportedVoxelType T> void build(const Parameters &Params);
+    void buildIntervalTrees();
+    static int32 buildIntervalNode(IntervalTree &Tree, TArray<Interval> &&Intervals);
+};